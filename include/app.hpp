@@ -397,6 +397,8 @@ struct AudioWidget : LedDisplay {
 	LedDisplayChoice *sampleRateChoice;
 	LedDisplaySeparator *sampleRateSeparator;
 	LedDisplayChoice *bufferSizeChoice;
+	LedDisplaySeparator *bufferSizeSeparator;
+	LedDisplayChoice *statsChoice;
 	AudioWidget();
 	void step() override;
 };
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+
+namespace rack {
+
+
+/** Alignment of every arena block, the size of a cache line */
+static const size_t ARENA_ALIGNMENT = 64;
+
+/** Returns a block of at least `size` bytes aligned to ARENA_ALIGNMENT.
+Blocks are carved from large slabs in the order they are allocated, so state allocated together sits together in memory.
+Freed blocks are kept in per-size free lists for reuse, so slabs are never returned to the heap and never fragment it.
+Only for the UI thread, which creates and deletes modules, so the arena takes no lock.
+*/
+void *arenaAlloc(size_t size);
+/** Returns a block from arenaAlloc() to the arena. `size` must be the size it was allocated with. */
+void arenaFree(void *p, size_t size);
+
+
+/** Standard allocator drawing from the engine arena */
+template <typename T>
+struct ArenaAllocator {
+	typedef T value_type;
+
+	ArenaAllocator() {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U> &other) {}
+	T *allocate(size_t n) {
+		return (T*) arenaAlloc(n * sizeof(T));
+	}
+	void deallocate(T *p, size_t n) {
+		arenaFree(p, n * sizeof(T));
+	}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+	return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+	return false;
+}
+
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+
+} // namespace rack
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <jansson.h>
+#include "profiler.hpp"
 
 #pragma GCC diagnostic push
 #ifndef __clang__
@@ -13,6 +15,48 @@
 namespace rack {
 
 
+/** Telemetry of an audio stream, for tuning block sizes from measurements rather than by ear.
+The callback thread records callbacks and FIFO fill levels, and the engine thread records latency and resampling ratios.
+Counters are atomic. Histograms are only written by the callback thread, so other threads may read them partially recorded, which is fine for display.
+*/
+struct AudioStats {
+	/** Callbacks the driver flagged with an input overflow or output underflow */
+	std::atomic<int> deviceXruns;
+	/** Callbacks which played silence because the engine hadn't produced enough output */
+	std::atomic<int> underruns;
+	/** Callbacks which dropped input because the engine hadn't consumed it */
+	std::atomic<int> overruns;
+	/** Times the engine gave up waiting on an unresponsive device */
+	std::atomic<int> timeouts;
+	/** Device frames since the stream opened, and at the last xrun or timeout, or -1 if there was none */
+	std::atomic<int64_t> frames;
+	std::atomic<int64_t> lastXrunFrame;
+	/** Fill levels in device frames of the input FIFO after each callback pushes to it, and of the output FIFO before each callback shifts from it */
+	ProfilerHistogram inputFill;
+	ProfilerHistogram outputFill;
+	/** Cycles between callbacks, and their deviation from the duration of the callback's frames */
+	ProfilerHistogram callbackInterval;
+	ProfilerHistogram callbackJitter;
+	uint64_t lastCallbackCycles = 0;
+	/** Estimated round trip from the device's inputs to its outputs through the engine, in device frames, or 0 if the stream isn't duplex */
+	std::atomic<int> latency;
+	/** Ratios of the input rate to the output rate of the resamplers from and to the device, including drift correction */
+	std::atomic<double> inputRatio;
+	std::atomic<double> outputRatio;
+	/** Set by any thread to clear the stats at the next callback */
+	std::atomic<bool> resetRequested;
+
+	AudioStats();
+	/** Called by the callback thread at the start of each callback */
+	void recordCallback(int frames, int sampleRate, bool xrun);
+	/** Marks an xrun or timeout at the current frame */
+	void recordXrun();
+	/** Returns the sum of xruns and timeouts */
+	int getXruns() const;
+	json_t *toJson(int sampleRate) const;
+};
+
+
 struct AudioIO {
 	// Stream properties
 	int driver = 0;
@@ -26,7 +70,9 @@ struct AudioIO {
 	RtAudio *rtAudio = NULL;
 	/** Cached */
 	RtAudio::DeviceInfo deviceInfo;
+	AudioStats stats;
 
+	/** Adds and removes this AudioIO from the list audioGetStatsJson() reads, which isn't locked. Construct and destroy from the UI thread. */
 	AudioIO();
 	virtual ~AudioIO();
 
@@ -54,12 +100,24 @@ struct AudioIO {
 	void closeStream();
 
 	virtual void processStream(const float *input, float *output, int frames) {}
+	/** Returns whether a stream at `sampleRate` would step the engine from its callback, which is then scheduled with the engine's real-time priority.
+	This is only checked when the stream opens. If the clock moves to the stream later, because the device holding it closed or the engine's sample rate changed, the stream keeps its priority until it is reopened.
+	*/
+	virtual bool isEngineClock(int sampleRate) {
+		return false;
+	}
 	virtual void onCloseStream() {}
 	virtual void onOpenStream() {}
 	virtual void onChannelsChange() {}
 	json_t *toJson();
 	void fromJson(json_t *rootJ);
+	/** Returns the device, stream settings, and stats */
+	json_t *statsToJson();
 };
 
 
+/** Returns an array of the statsToJson() of every AudioIO with an open stream. Call from the UI thread. */
+json_t *audioGetStatsJson();
+
+
 } // namespace rack
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "util/math.hpp"
+#include "dsp/simd.hpp"
 
 
 namespace rack {
@@ -57,6 +58,35 @@ struct SchmittTrigger {
 };
 
 
+/** SchmittTrigger for a simd::Vector of signals.
+Returns masks rather than bools, with all bits set in the lanes which triggered.
+*/
+template <typename T>
+struct TSchmittTrigger {
+	/** Mask of the lanes in the HIGH state.
+	Starts HIGH so that, like the UNKNOWN state of SchmittTrigger, an input already above 1 does not trigger.
+	*/
+	T state;
+
+	TSchmittTrigger() {
+		reset();
+	}
+	void reset() {
+		state = T::mask();
+	}
+	T process(T in) {
+		T on = (in >= 1.f);
+		T off = (in <= 0.f);
+		T triggered = simd::andnot(state, on);
+		state = on | simd::andnot(off, state);
+		return triggered;
+	}
+	T isHigh() {
+		return state;
+	}
+};
+
+
 struct BooleanTrigger {
 	bool lastState;
 
@@ -103,4 +133,32 @@ struct PulseGenerator {
 };
 
 
+/** PulseGenerator for a simd::Vector of pulses */
+template <typename T>
+struct TPulseGenerator {
+	T time;
+	T triggerDuration;
+
+	TPulseGenerator() {
+		reset();
+	}
+	void reset() {
+		time = 0.f;
+		triggerDuration = 0.f;
+	}
+	/** Returns a mask of the lanes in the HIGH state */
+	T process(float deltaTime) {
+		time += deltaTime;
+		return time < triggerDuration;
+	}
+	/** Begins a trigger in the lanes set in `mask` */
+	void trigger(T mask, float triggerDuration) {
+		// Same rule as PulseGenerator::trigger(), lane by lane
+		T restart = mask & (time + triggerDuration >= this->triggerDuration);
+		time = simd::ifelse(restart, T(0.f), time);
+		this->triggerDuration = simd::ifelse(restart, T(triggerDuration), this->triggerDuration);
+	}
+};
+
+
 } // namespace rack
@@ -1,32 +1,37 @@
 #pragma once
 
 #include "util/math.hpp"
+#include "dsp/simd.hpp"
 
 
 namespace rack {
 
-struct RCFilter {
-	float c = 0.f;
-	float xstate[1] = {};
-	float ystate[1] = {};
+/** `T` is `float`, or a simd::Vector to filter several signals at once */
+template <typename T = float>
+struct TRCFilter {
+	T c = 0.f;
+	T xstate[1] = {0.f};
+	T ystate[1] = {0.f};
 
 	// `r` is the ratio between the cutoff frequency and sample rate, i.e. r = f_c / f_s
-	void setCutoff(float r) {
+	void setCutoff(T r) {
 		c = 2.f / r;
 	}
-	void process(float x) {
-		float y = (x + xstate[0] - ystate[0] * (1 - c)) / (1 + c);
+	void process(T x) {
+		T y = (x + xstate[0] - ystate[0] * (1.f - c)) / (1.f + c);
 		xstate[0] = x;
 		ystate[0] = y;
 	}
-	float lowpass() {
+	T lowpass() {
 		return ystate[0];
 	}
-	float highpass() {
+	T highpass() {
 		return xstate[0] - ystate[0];
 	}
 };
 
+typedef TRCFilter<> RCFilter;
+
 
 struct PeakFilter {
 	float state = 0.f;
@@ -47,39 +52,42 @@ struct PeakFilter {
 };
 
 
-struct SlewLimiter {
-	float rise = 1.f;
-	float fall = 1.f;
-	float out = 0.f;
+template <typename T = float>
+struct TSlewLimiter {
+	T rise = 1.f;
+	T fall = 1.f;
+	T out = 0.f;
 
-	void setRiseFall(float rise, float fall) {
+	void setRiseFall(T rise, T fall) {
 		this->rise = rise;
 		this->fall = fall;
 	}
-	float process(float in) {
-		out = clamp(in, out - fall, out + rise);
+	T process(T in) {
+		out = simd::clamp(in, out - fall, out + rise);
 		return out;
 	}
 };
 
+typedef TSlewLimiter<> SlewLimiter;
+
 
 /** Applies exponential smoothing to a signal with the ODE
 dy/dt = x * lambda
 */
-struct ExponentialFilter {
-	float out = 0.f;
-	float lambda = 1.f;
+template <typename T = float>
+struct TExponentialFilter {
+	T out = 0.f;
+	T lambda = 1.f;
 
-	float process(float in) {
-		float y = out + (in - out) * lambda;
+	T process(T in) {
+		T y = out + (in - out) * lambda;
 		// If no change was detected, assume float granularity is too small and snap output to input
-		if (out == y)
-			out = in;
-		else
-			out = y;
+		out = simd::ifelse(out == y, in, y);
 		return out;
 	}
 };
 
+typedef TExponentialFilter<> ExponentialFilter;
+
 
 } // namespace rack
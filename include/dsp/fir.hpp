@@ -22,6 +22,7 @@ inline void boxcarLowpassIR(float *out, int len, float cutoff = 0.5f) {
 	}
 }
 
+/** Multiplies `x` by a Blackman-Harris window. Fill `x` with 1 to get the window itself. */
 inline void blackmanHarrisWindow(float *x, int len) {
 	// Constants from https://en.wikipedia.org/wiki/Window_function#Blackman%E2%80%93Harris_window
 	const float a0 = 0.35875f;
@@ -30,7 +31,7 @@ inline void blackmanHarrisWindow(float *x, int len) {
 	const float a3 = 0.01168f;
 	float factor = 2*M_PI / (len - 1);
 	for (int i = 0; i < len; i++) {
-		x[i]=
+		x[i] *=
 			a0
 			- a1 * cosf(1*factor * i)
 			+ a2 * cosf(2*factor * i)
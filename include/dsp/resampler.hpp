@@ -2,45 +2,144 @@
 
 #include <assert.h>
 #include <string.h>
-#include <speex/speex_resampler.h>
+#include <math.h>
+#include <vector>
 #include "frame.hpp"
+#include "simd.hpp"
 #include "ringbuffer.hpp"
 #include "fir.hpp"
 
 
 namespace rack {
 
+/** The filter of each SampleRateConverter quality, the same as the qualities of speexdsp's resampler */
+struct SampleRateConverterQuality {
+	/** Taps of the filter, lengthened by the ratio when downsampling */
+	int length;
+	/** Tabulated phases per tap when the ratio needs interpolated phases */
+	int oversample;
+	/** Cutoffs relative to the Nyquist frequency of the lower rate */
+	float downsampleBandwidth;
+	float upsampleBandwidth;
+	/** Kaiser window beta, for about 63, 81, 99, and 117 dB of stopband attenuation */
+	double beta;
+};
+
+static const SampleRateConverterQuality sampleRateConverterQualities[11] = {
+	{8, 4, 0.830f, 0.860f, 6.0},
+	{16, 4, 0.850f, 0.880f, 6.0},
+	{32, 4, 0.882f, 0.910f, 6.0},
+	{48, 8, 0.895f, 0.917f, 8.0},
+	{64, 8, 0.921f, 0.940f, 8.0},
+	{80, 16, 0.922f, 0.940f, 10.0},
+	{96, 16, 0.940f, 0.945f, 10.0},
+	{128, 16, 0.950f, 0.950f, 10.0},
+	{160, 16, 0.960f, 0.960f, 10.0},
+	{192, 32, 0.968f, 0.968f, 12.0},
+	{256, 32, 0.975f, 0.975f, 12.0},
+};
+
+/** The zeroth order modified Bessel function of the first kind, for the Kaiser window */
+inline double besselI0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 100; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+/** A sinc lowpass with a `cutoff` relative to the Nyquist frequency in a Kaiser window `length` samples wide, evaluated `x` samples from its center */
+inline double kaiserSinc(double cutoff, double x, int length, double beta) {
+	if (fabs(x) < 1e-6)
+		return cutoff;
+	if (fabs(x) > 0.5 * length)
+		return 0.0;
+	double r = 2.0 * x / length;
+	double window = besselI0(beta * sqrt(fmax(1.0 - r * r, 0.0))) / besselI0(beta);
+	double xx = M_PI * cutoff * x;
+	return cutoff * sin(xx) / xx * window;
+}
+
+
+/** Converts the sample rate of interleaved frames with a polyphase windowed sinc filter.
+Each output frame is filtered for all channels at once from one interleaved history, 4 channels per SIMD instruction, so the filter phase is computed once per frame rather than once per channel.
+*/
 template<int CHANNELS>
 struct SampleRateConverter {
-	SpeexResamplerState *st = NULL;
+	/** Input frames appended to the history at a time */
+	static const int HISTORY_CHUNK = 256;
+	/** Filters of at most this many coefficients are tabulated at each phase of the uncorrected ratio instead of interpolated */
+	static const int DIRECT_TABLE_SIZE = 1 << 16;
+	/** The filter and history are reserved for ratios of the rates up to this, so only rates further apart allocate when they are set */
+	static const int MAX_RATIO = 8;
+
 	int channels = CHANNELS;
-	int quality = SPEEX_RESAMPLER_QUALITY_DEFAULT;
+	int quality = 4;
 	int inRate = 44100;
 	int outRate = 44100;
+	/** Factor of the ratio of the input rate to the output rate */
+	double correction = 1.0;
+
+	/** Whether frames are filtered rather than copied */
+	bool converting = false;
+	int filterLength = 0;
+	int oversample = 1;
+	/** The ratio of the input rate to the output rate is num / den.
+	Each output frame advances the input by intAdvance frames and fracAdvance / den of a frame.
+	*/
+	uint32_t num = 1;
+	uint32_t den = 1;
+	uint32_t intAdvance = 1;
+	uint32_t fracAdvance = 0;
+	/** The filter at each of the directDen phases of the uncorrected ratio, or empty with a directDen of 0 if it has too many coefficients */
+	std::vector<float> directTable;
+	uint32_t directDen = 0;
+	/** If true, the ratio is uncorrected and the filter of each output frame is read from `directTable` */
+	bool direct = true;
+	/** The filter at `oversample` phases per tap, with a phase of margin on each side, from which `kernel` is interpolated for each output frame of any other ratio */
+	std::vector<float> table;
+	std::vector<float> kernel;
+
+	/** Input frames padded to a multiple of 4 channels, so each group of 4 channels is one simd::float_4 */
+	std::vector<float> history;
+	int stride = 0;
+	int historyFrames = 0;
+	/** Frame in the history of the first tap of the next output frame */
+	int lastFrame = 0;
+	/** Phase of the next output frame after lastFrame, over den */
+	uint32_t frac = 0;
 
 	SampleRateConverter() {
+		reserve();
 		refreshState();
 	}
-	~SampleRateConverter() {
-		if (st) {
-			speex_resampler_destroy(st);
-		}
-	}
 
-	/** Sets the number of channels to actually process. This can be at most CHANNELS. */
+	/** Sets the number of channels to actually process. This can be at most CHANNELS.
+	The filter doesn't depend on the channels, so this only clears the history.
+	*/
 	void setChannels(int channels) {
 		assert(channels <= CHANNELS);
 		if (channels == this->channels)
 			return;
 		this->channels = channels;
-		refreshState();
+		stride = (channels + 3) / 4 * 4;
+		converting = (channels > 0 && (inRate != outRate || correction != 1.0));
+		clearHistory();
 	}
 
-	/** From 0 (worst, fastest) to 10 (best, slowest) */
+	/** From 0 (worst, fastest) to 10 (best, slowest).
+	The default of 4 attenuates images and aliases by about 81 dB, which bounds the SNR of converting full-band audio between 44.1 and 48 kHz. A sine far below the cutoff measures higher.
+	This reallocates the filter, so set it before processing.
+	*/
 	void setQuality(int quality) {
 		if (quality == this->quality)
 			return;
 		this->quality = quality;
+		reserve();
 		refreshState();
 	}
 
@@ -52,49 +151,246 @@ struct SampleRateConverter {
 		refreshState();
 	}
 
+	/** Multiplies the ratio of the input rate to the output rate by `correction`, to follow the drift between the clocks of the input and the output.
+	The filter is designed for the uncorrected ratio and interpolated at the phases of the corrected one, so this neither allocates nor recomputes the filter.
+	Corrections should stay within a fraction of a percent, which keeps the output's Nyquist frequency inside the filter's transition band.
+	*/
+	void setRateCorrection(double correction) {
+		if (correction == this->correction)
+			return;
+		this->correction = correction;
+		refreshRatio();
+		if (!converting && correction != 1.0 && channels > 0) {
+			// Keep filtering once the rates are equal again, so the delay of the filter doesn't come and go with the correction
+			converting = true;
+			clearHistory();
+		}
+	}
+
+	/** Returns the ratio of the input rate to the output rate, including the correction */
+	double getRatio() const {
+		return (double) inRate / outRate * correction;
+	}
+
+	/** Returns the delay of the filter in input frames */
+	double getDelay() const {
+		return converting ? filterLength / 2.0 : 0.0;
+	}
+
+	static uint32_t gcd(uint32_t a, uint32_t b) {
+		while (b != 0) {
+			uint32_t t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+
+	/** Reserves the filter and history of the quality for every ratio up to MAX_RATIO and every channel */
+	void reserve() {
+		const SampleRateConverterQuality &q = sampleRateConverterQualities[clamp(quality, 0, 10)];
+		int maxLength = q.length * MAX_RATIO;
+		directTable.reserve(DIRECT_TABLE_SIZE);
+		table.reserve((q.oversample + 3) * maxLength);
+		kernel.reserve(maxLength);
+		history.reserve((maxLength + MAX_RATIO + 1 + HISTORY_CHUNK) * ((CHANNELS + 3) / 4 * 4));
+	}
+
+	/** Recomputes the filter for the uncorrected ratio and clears the history.
+	Within the reserved sizes, this doesn't allocate.
+	*/
 	void refreshState() {
-		if (st) {
-			speex_resampler_destroy(st);
-			st = NULL;
+		converting = (channels > 0 && (inRate != outRate || correction != 1.0));
+		stride = (channels + 3) / 4 * 4;
+
+		uint32_t g = gcd(inRate, outRate);
+		uint32_t baseNum = inRate / g;
+		uint32_t baseDen = outRate / g;
+		const SampleRateConverterQuality &q = sampleRateConverterQualities[clamp(quality, 0, 10)];
+		filterLength = q.length;
+		oversample = q.oversample;
+		double cutoff;
+		if (baseNum > baseDen) {
+			// Lower the cutoff to the output's Nyquist frequency, and lengthen the filter to keep its transition band as steep
+			cutoff = q.downsampleBandwidth * baseDen / baseNum;
+			filterLength = ((uint64_t) filterLength * baseNum / baseDen + 7) / 8 * 8;
+			for (int i = 2; i <= 16; i *= 2) {
+				if ((uint64_t) i * baseDen < baseNum)
+					oversample /= 2;
+			}
+			if (oversample < 1)
+				oversample = 1;
+		}
+		else {
+			cutoff = q.upsampleBandwidth;
 		}
 
-		if (channels > 0 && inRate != outRate) {
-			int err;
-			st = speex_resampler_init(channels, inRate, outRate, quality, &err);
-			assert(st);
-			assert(err == RESAMPLER_ERR_SUCCESS);
+		if ((uint64_t) baseDen * filterLength <= DIRECT_TABLE_SIZE) {
+			directTable.resize(baseDen * filterLength);
+			for (uint32_t i = 0; i < baseDen; i++) {
+				for (int j = 0; j < filterLength; j++) {
+					directTable[i * filterLength + j] = kaiserSinc(cutoff, (j - filterLength / 2 + 1) - (double) i / baseDen, filterLength, q.beta);
+				}
+			}
+			directDen = baseDen;
+		}
+		else {
+			directTable.clear();
+			directDen = 0;
+		}
+		// Row r holds the phase (r - 1) / oversample after each tap
+		table.resize((oversample + 3) * filterLength);
+		for (int r = 0; r < oversample + 3; r++) {
+			for (int j = 0; j < filterLength; j++) {
+				table[r * filterLength + j] = kaiserSinc(cutoff, (j - filterLength / 2) + (double) (r - 1) / oversample, filterLength, q.beta);
+			}
+		}
+		kernel.resize(filterLength);
 
-			speex_resampler_set_input_stride(st, CHANNELS);
-			speex_resampler_set_output_stride(st, CHANNELS);
+		// A corrected ratio advances at most a frame further than the uncorrected one.
+		// Size the history for every channel, so setChannels() needn't resize it.
+		history.resize((filterLength + baseNum / baseDen + 1 + HISTORY_CHUNK) * ((CHANNELS + 3) / 4 * 4));
+		clearHistory();
+		refreshRatio();
+	}
+
+	/** Sets num / den to the corrected ratio, keeping the phase of the next output frame */
+	void refreshRatio() {
+		// Scale both rates as far as the ratio fits in 32-bit integers, so small corrections are resolved
+		uint32_t maxRate = (inRate > outRate) ? inRate : outRate;
+		uint32_t scale = 0x7fffffff / maxRate;
+		uint32_t newNum = (uint32_t) (inRate * correction * scale + 0.5);
+		uint32_t newDen = outRate * scale;
+		uint32_t g = gcd(newNum, newDen);
+		newNum /= g;
+		newDen /= g;
+		// Move the phase of the next output frame to the new denominator
+		frac = (uint32_t) ((uint64_t) frac * newDen / den);
+		num = newNum;
+		den = newDen;
+		intAdvance = num / den;
+		fracAdvance = num % den;
+		direct = (den == directDen);
+	}
+
+	/** Starts the history with the filter's length of silence before the next input frame */
+	void clearHistory() {
+		historyFrames = filterLength - 1;
+		memset(history.data(), 0, historyFrames * stride * sizeof(float));
+		lastFrame = 0;
+		frac = 0;
+	}
+
+	/** Interpolates the filter at the phase of the next output frame with the cubic coefficients speexdsp uses */
+	const float *interpolateKernel() {
+		uint64_t phase = (uint64_t) frac * oversample;
+		int offset = phase / den;
+		float x = (float) (phase % den) / den;
+		float c0 = -0.16667f * x + 0.16667f * x * x * x;
+		float c1 = x + 0.5f * x * x - 0.5f * x * x * x;
+		float c3 = -0.33333f * x + 0.5f * x * x - 0.16667f * x * x * x;
+		float c2 = 1.f - c0 - c1 - c3;
+		const float *r0 = &table[(oversample - offset - 1) * filterLength];
+		const float *r1 = r0 + filterLength;
+		const float *r2 = r1 + filterLength;
+		const float *r3 = r2 + filterLength;
+		// Filter lengths are multiples of 8
+		for (int j = 0; j < filterLength; j += 4) {
+			simd::float_4 k = simd::float_4::load(&r0[j]) * c0 + simd::float_4::load(&r1[j]) * c1 + simd::float_4::load(&r2[j]) * c2 + simd::float_4::load(&r3[j]) * c3;
+			k.store(&kernel[j]);
 		}
+		return kernel.data();
 	}
 
 	/** `in` and `out` are interlaced with the number of channels */
 	void process(const Frame<CHANNELS> *in, int *inFrames, Frame<CHANNELS> *out, int *outFrames) {
+		process(in->samples, CHANNELS, inFrames, out->samples, CHANNELS, outFrames);
+	}
+
+	/** `in` and `out` hold frames `inStride` and `outStride` floats apart, such as a device buffer interlaced with its number of channels.
+	Only the first `channels` samples of each output frame are written.
+	*/
+	void process(const float *in, int inStride, int *inFrames, float *out, int outStride, int *outFrames) {
 		assert(in);
 		assert(inFrames);
 		assert(out);
 		assert(outFrames);
-		if (st) {
-			// Resample each channel at a time
-			spx_uint32_t inLen;
-			spx_uint32_t outLen;
-			for (int i = 0; i < channels; i++) {
-				inLen = *inFrames;
-				outLen = *outFrames;
-				int err = speex_resampler_process_float(st, i, ((const float*) in) + i, &inLen, ((float*) out) + i, &outLen);
-				assert(err == RESAMPLER_ERR_SUCCESS);
-			}
-			*inFrames = inLen;
-			*outFrames = outLen;
-		}
-		else {
+		assert(inStride >= channels && outStride >= channels);
+		if (!converting) {
 			// Simply copy the buffer without conversion
 			int frames = min_rack(*inFrames, *outFrames);
-			memcpy(out, in, frames * sizeof(Frame<CHANNELS>));
+			if (inStride == outStride) {
+				memcpy(out, in, frames * inStride * sizeof(float));
+			}
+			else {
+				for (int i = 0; i < frames; i++) {
+					memcpy(&out[i * outStride], &in[i * inStride], channels * sizeof(float));
+				}
+			}
 			*inFrames = frames;
 			*outFrames = frames;
+			return;
+		}
+
+		int groups = (channels + 3) / 4;
+		int capacity = history.size() / stride;
+		int inUsed = 0;
+		int outUsed = 0;
+		while (true) {
+			// Append as much input as fits
+			int n = min_rack(*inFrames - inUsed, capacity - historyFrames);
+			for (int i = 0; i < n; i++) {
+				memcpy(&history[(historyFrames + i) * stride], &in[(inUsed + i) * inStride], channels * sizeof(float));
+			}
+			historyFrames += n;
+			inUsed += n;
+
+			// Filter each output frame whose taps are all in the history
+			while (outUsed < *outFrames && lastFrame + filterLength <= historyFrames) {
+				const float *k = direct ? &directTable[frac * filterLength] : interpolateKernel();
+				const float *h = &history[lastFrame * stride];
+				float *o = &out[outUsed * outStride];
+				for (int g = 0; g < groups; g++) {
+					// Two sums hide the latency of the additions. Filter lengths are multiples of 8.
+					simd::float_4 sum0 = 0.f;
+					simd::float_4 sum1 = 0.f;
+					const float *hg = &h[4 * g];
+					for (int j = 0; j < filterLength; j += 2) {
+						sum0 += simd::float_4(k[j]) * simd::float_4::load(&hg[j * stride]);
+						sum1 += simd::float_4(k[j + 1]) * simd::float_4::load(&hg[(j + 1) * stride]);
+					}
+					simd::float_4 sum = sum0 + sum1;
+					if (4 * g + 4 <= channels) {
+						sum.store(&o[4 * g]);
+					}
+					else {
+						float s[4];
+						sum.store(s);
+						memcpy(&o[4 * g], s, (channels - 4 * g) * sizeof(float));
+					}
+				}
+				outUsed++;
+
+				lastFrame += intAdvance;
+				frac += fracAdvance;
+				if (frac >= den) {
+					frac -= den;
+					lastFrame++;
+				}
+			}
+
+			// Drop the frames before the first tap of the next output frame
+			int drop = min_rack(lastFrame, historyFrames);
+			if (drop > 0) {
+				memmove(&history[0], &history[drop * stride], (historyFrames - drop) * stride * sizeof(float));
+				historyFrames -= drop;
+				lastFrame -= drop;
+			}
+			if (outUsed == *outFrames || inUsed == *inFrames)
+				break;
 		}
+		*inFrames = inUsed;
+		*outFrames = outUsed;
 	}
 };
 
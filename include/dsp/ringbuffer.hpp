@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 #include "util/common.hpp"
 
 
@@ -63,6 +66,116 @@ struct RingBuffer {
 	}
 };
 
+/** A wait-free cyclic buffer for exactly one producer thread and one consumer thread, such as an audio device callback and the engine.
+The capacity and the number of Ts in each element are set at runtime with resize(), so the same buffer can carry interleaved frames of any number of audio channels.
+The capacity is rounded up to a power of 2. Elements are passed as pointers to `stride()` consecutive Ts, and counts are in elements.
+Only the producer moves `end` and only the consumer moves `start`, each publishing its elements to the other with release ordering.
+The indices are aligned to separate cache lines so the two threads don't contend over them.
+Either thread may call size(), empty(), capacity(), and full().
+Only the producer may call push(), endData(), endCapacity(), and endIncr(),
+and only the consumer may call shift(), startData(), startSize(), startIncr(), and clear().
+resize() is not thread-safe, so neither thread may access the buffer while it is resized.
+*/
+template <typename T>
+struct SPSCRingBuffer {
+	std::vector<T> data;
+	size_t elementStride = 1;
+	size_t elements = 0;
+	alignas(64) std::atomic<size_t> start;
+	alignas(64) std::atomic<size_t> end;
+
+	SPSCRingBuffer() : start(0), end(0) {}
+
+	/** Reallocates the buffer for at least `size` elements of `stride` Ts, discarding its elements */
+	void resize(size_t size, size_t stride = 1) {
+		size_t s = 1;
+		while (s < size)
+			s *= 2;
+		elementStride = stride;
+		elements = s;
+		data.assign(s * stride, T());
+		start.store(0);
+		end.store(0);
+	}
+
+	size_t stride() const {
+		return elementStride;
+	}
+	size_t mask(size_t i) const {
+		return i & (elements - 1);
+	}
+
+	size_t size() const {
+		return end.load(std::memory_order_acquire) - start.load(std::memory_order_acquire);
+	}
+	bool empty() const {
+		return size() == 0;
+	}
+	size_t capacity() const {
+		return elements - size();
+	}
+	bool full() const {
+		return size() == elements;
+	}
+
+	// Producer
+	/** Returns false without pushing if the buffer is full */
+	bool push(const T *t) {
+		size_t e = end.load(std::memory_order_relaxed);
+		if (e - start.load(std::memory_order_acquire) == elements)
+			return false;
+		std::copy(t, t + elementStride, &data[mask(e) * elementStride]);
+		end.store(e + 1, std::memory_order_release);
+		return true;
+	}
+	/** Returns a pointer to endCapacity() consecutive elements for appending.
+	If any data is appended, you must call endIncr afterwards.
+	*/
+	T *endData() {
+		return &data[mask(end.load(std::memory_order_relaxed)) * elementStride];
+	}
+	/** Returns the number of elements which can be appended before the buffer is full or wraps around */
+	size_t endCapacity() const {
+		size_t e = mask(end.load(std::memory_order_relaxed));
+		size_t c = capacity();
+		return (e + c < elements) ? c : elements - e;
+	}
+	void endIncr(size_t n) {
+		end.store(end.load(std::memory_order_relaxed) + n, std::memory_order_release);
+	}
+
+	// Consumer
+	/** Returns false without shifting if the buffer is empty */
+	bool shift(T *t) {
+		size_t s = start.load(std::memory_order_relaxed);
+		if (end.load(std::memory_order_acquire) == s)
+			return false;
+		const T *element = &data[mask(s) * elementStride];
+		std::copy(element, element + elementStride, t);
+		start.store(s + 1, std::memory_order_release);
+		return true;
+	}
+	/** Returns a pointer to startSize() consecutive elements for consumption.
+	If any data is consumed, call startIncr afterwards.
+	*/
+	const T *startData() const {
+		return &data[mask(start.load(std::memory_order_relaxed)) * elementStride];
+	}
+	/** Returns the number of elements which can be consumed before the buffer is empty or wraps around */
+	size_t startSize() const {
+		size_t s = mask(start.load(std::memory_order_relaxed));
+		size_t n = size();
+		return (s + n < elements) ? n : elements - s;
+	}
+	void startIncr(size_t n) {
+		start.store(start.load(std::memory_order_relaxed) + n, std::memory_order_release);
+	}
+	/** Discards all elements pushed so far */
+	void clear() {
+		start.store(end.load(std::memory_order_acquire), std::memory_order_release);
+	}
+};
+
 /** A cyclic buffer which maintains a valid linear array of size S by keeping a copy of the buffer in adjacent memory.
 S must be a power of 2.
 Thread-safe for single producers and consumers?
@@ -0,0 +1,540 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "util/common.hpp"
+
+// Use SSE for 4 lanes and AVX for 8 lanes when the compiler targets them.
+// Define RACK_SIMD_SCALAR to always use the scalar fallback, for example to check results against it.
+#if !defined(RACK_SIMD_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define RACK_SIMD_SSE 1
+	#include <emmintrin.h>
+	#if defined(__SSE4_1__)
+		#include <smmintrin.h>
+	#endif
+#endif
+#if !defined(RACK_SIMD_SCALAR) && defined(__AVX__)
+	#define RACK_SIMD_AVX 1
+	#include <immintrin.h>
+#endif
+
+
+namespace rack {
+namespace simd {
+
+
+/** A vector of `N` lanes of 32 bit `T`, for processing several voices or modules with each instruction.
+This generic version is the scalar fallback, which loops over its lanes.
+The instruction set versions are specializations below.
+
+Comparisons return masks of the same type with all bits set in lanes where the comparison is true, for use with the bitwise operators and ifelse().
+*/
+template <typename T, int N>
+struct Vector {
+	static_assert(sizeof(T) == 4, "Vector lanes must be 32 bits");
+	T s[N];
+
+	/** Leaves the lanes uninitialized */
+	Vector() {}
+	/** Sets all lanes to `x` */
+	Vector(T x) {
+		for (int i = 0; i < N; i++)
+			s[i] = x;
+	}
+	static Vector load(const T *x) {
+		Vector v;
+		memcpy(v.s, x, sizeof(v.s));
+		return v;
+	}
+	void store(T *x) const {
+		memcpy(x, s, sizeof(s));
+	}
+	/** Returns a vector with all bits set, the "true" value of masks */
+	static Vector mask() {
+		Vector v;
+		memset(v.s, 0xff, sizeof(v.s));
+		return v;
+	}
+	T &operator[](int i) {
+		return s[i];
+	}
+	const T &operator[](int i) const {
+		return s[i];
+	}
+};
+
+
+typedef Vector<float, 4> float_4;
+typedef Vector<int32_t, 4> int32_4;
+typedef Vector<float, 8> float_8;
+typedef Vector<int32_t, 8> int32_8;
+
+
+////////////////////
+// Scalar fallback
+////////////////////
+
+template <typename T>
+inline uint32_t laneToBits(T x) {
+	uint32_t b;
+	memcpy(&b, &x, sizeof(b));
+	return b;
+}
+
+template <typename T>
+inline T laneFromBits(uint32_t b) {
+	T x;
+	memcpy(&x, &b, sizeof(x));
+	return x;
+}
+
+template <typename T>
+inline T laneMask(bool x) {
+	return laneFromBits<T>(x ? 0xffffffff : 0);
+}
+
+#define RACK_SIMD_LANES(expr) \
+	Vector<T, N> r; \
+	for (int i = 0; i < N; i++) \
+		r.s[i] = (expr); \
+	return r;
+
+template <typename T, int N>
+inline Vector<T, N> operator+(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(a.s[i] + b.s[i])}
+template <typename T, int N>
+inline Vector<T, N> operator-(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(a.s[i] - b.s[i])}
+template <typename T, int N>
+inline Vector<T, N> operator*(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(a.s[i] * b.s[i])}
+template <typename T, int N>
+inline Vector<T, N> operator/(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(a.s[i] / b.s[i])}
+template <typename T, int N>
+inline Vector<T, N> operator-(const Vector<T, N> &a) {RACK_SIMD_LANES(-a.s[i])}
+
+template <typename T, int N>
+inline Vector<T, N> operator==(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneMask<T>(a.s[i] == b.s[i]))}
+template <typename T, int N>
+inline Vector<T, N> operator!=(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneMask<T>(a.s[i] != b.s[i]))}
+template <typename T, int N>
+inline Vector<T, N> operator<(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneMask<T>(a.s[i] < b.s[i]))}
+template <typename T, int N>
+inline Vector<T, N> operator<=(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneMask<T>(a.s[i] <= b.s[i]))}
+template <typename T, int N>
+inline Vector<T, N> operator>(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneMask<T>(a.s[i] > b.s[i]))}
+template <typename T, int N>
+inline Vector<T, N> operator>=(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneMask<T>(a.s[i] >= b.s[i]))}
+
+template <typename T, int N>
+inline Vector<T, N> operator&(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneFromBits<T>(laneToBits(a.s[i]) & laneToBits(b.s[i])))}
+template <typename T, int N>
+inline Vector<T, N> operator|(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneFromBits<T>(laneToBits(a.s[i]) | laneToBits(b.s[i])))}
+template <typename T, int N>
+inline Vector<T, N> operator^(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneFromBits<T>(laneToBits(a.s[i]) ^ laneToBits(b.s[i])))}
+/** Returns `~a & b` */
+template <typename T, int N>
+inline Vector<T, N> andnot(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES(laneFromBits<T>(~laneToBits(a.s[i]) & laneToBits(b.s[i])))}
+
+template <typename T, int N>
+inline Vector<T, N> fmin(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES((a.s[i] < b.s[i]) ? a.s[i] : b.s[i])}
+template <typename T, int N>
+inline Vector<T, N> fmax(const Vector<T, N> &a, const Vector<T, N> &b) {RACK_SIMD_LANES((a.s[i] > b.s[i]) ? a.s[i] : b.s[i])}
+template <int N>
+inline Vector<float, N> floor(const Vector<float, N> &a) {typedef float T; RACK_SIMD_LANES(floorf(a.s[i]))}
+template <int N>
+inline Vector<float, N> sqrt(const Vector<float, N> &a) {typedef float T; RACK_SIMD_LANES(sqrtf(a.s[i]))}
+
+/** Converts each lane to an integer, rounding toward zero */
+template <int N>
+inline Vector<int32_t, N> toInt(const Vector<float, N> &a) {typedef int32_t T; RACK_SIMD_LANES((int32_t) a[i])}
+template <int N>
+inline Vector<float, N> toFloat(const Vector<int32_t, N> &a) {typedef float T; RACK_SIMD_LANES((float) a[i])}
+/** Reinterprets the bits of each lane */
+template <int N>
+inline Vector<float, N> bitsToFloat(const Vector<int32_t, N> &a) {typedef float T; RACK_SIMD_LANES(laneFromBits<float>(a[i]))}
+template <int N>
+inline Vector<int32_t, N> floatToBits(const Vector<float, N> &a) {typedef int32_t T; RACK_SIMD_LANES((int32_t) laneToBits(a[i]))}
+
+template <int N>
+inline Vector<int32_t, N> operator<<(const Vector<int32_t, N> &a, int b) {typedef int32_t T; RACK_SIMD_LANES((int32_t) ((uint32_t) a.s[i] << b))}
+template <int N>
+inline Vector<int32_t, N> operator>>(const Vector<int32_t, N> &a, int b) {typedef int32_t T; RACK_SIMD_LANES(a.s[i] >> b)}
+
+/** Returns a bit for each lane with its sign bit set, such as the lanes of a mask which are true */
+template <typename T, int N>
+inline int movemask(const Vector<T, N> &a) {
+	int m = 0;
+	for (int i = 0; i < N; i++)
+		m |= (laneToBits(a.s[i]) >> 31) << i;
+	return m;
+}
+
+#undef RACK_SIMD_LANES
+
+
+////////////////////
+// SSE
+////////////////////
+
+#if RACK_SIMD_SSE
+
+template <>
+struct Vector<float, 4> {
+	union {
+		__m128 v;
+		float s[4];
+	};
+
+	Vector() {}
+	Vector(float x) {
+		v = _mm_set1_ps(x);
+	}
+	Vector(__m128 v) : v(v) {}
+	static Vector load(const float *x) {
+		return Vector(_mm_loadu_ps(x));
+	}
+	void store(float *x) const {
+		_mm_storeu_ps(x, v);
+	}
+	static Vector mask() {
+		return Vector(_mm_castsi128_ps(_mm_set1_epi32(-1)));
+	}
+	float &operator[](int i) {
+		return s[i];
+	}
+	const float &operator[](int i) const {
+		return s[i];
+	}
+};
+
+template <>
+struct Vector<int32_t, 4> {
+	union {
+		__m128i v;
+		int32_t s[4];
+	};
+
+	Vector() {}
+	Vector(int32_t x) {
+		v = _mm_set1_epi32(x);
+	}
+	Vector(__m128i v) : v(v) {}
+	static Vector load(const int32_t *x) {
+		return Vector(_mm_loadu_si128((const __m128i*) x));
+	}
+	void store(int32_t *x) const {
+		_mm_storeu_si128((__m128i*) x, v);
+	}
+	static Vector mask() {
+		return Vector(_mm_set1_epi32(-1));
+	}
+	int32_t &operator[](int i) {
+		return s[i];
+	}
+	const int32_t &operator[](int i) const {
+		return s[i];
+	}
+};
+
+inline float_4 operator+(const float_4 &a, const float_4 &b) {return _mm_add_ps(a.v, b.v);}
+inline float_4 operator-(const float_4 &a, const float_4 &b) {return _mm_sub_ps(a.v, b.v);}
+inline float_4 operator*(const float_4 &a, const float_4 &b) {return _mm_mul_ps(a.v, b.v);}
+inline float_4 operator/(const float_4 &a, const float_4 &b) {return _mm_div_ps(a.v, b.v);}
+inline float_4 operator-(const float_4 &a) {return _mm_xor_ps(a.v, _mm_set1_ps(-0.f));}
+inline float_4 operator==(const float_4 &a, const float_4 &b) {return _mm_cmpeq_ps(a.v, b.v);}
+inline float_4 operator!=(const float_4 &a, const float_4 &b) {return _mm_cmpneq_ps(a.v, b.v);}
+inline float_4 operator<(const float_4 &a, const float_4 &b) {return _mm_cmplt_ps(a.v, b.v);}
+inline float_4 operator<=(const float_4 &a, const float_4 &b) {return _mm_cmple_ps(a.v, b.v);}
+inline float_4 operator>(const float_4 &a, const float_4 &b) {return _mm_cmpgt_ps(a.v, b.v);}
+inline float_4 operator>=(const float_4 &a, const float_4 &b) {return _mm_cmpge_ps(a.v, b.v);}
+inline float_4 operator&(const float_4 &a, const float_4 &b) {return _mm_and_ps(a.v, b.v);}
+inline float_4 operator|(const float_4 &a, const float_4 &b) {return _mm_or_ps(a.v, b.v);}
+inline float_4 operator^(const float_4 &a, const float_4 &b) {return _mm_xor_ps(a.v, b.v);}
+inline float_4 andnot(const float_4 &a, const float_4 &b) {return _mm_andnot_ps(a.v, b.v);}
+inline float_4 fmin(const float_4 &a, const float_4 &b) {return _mm_min_ps(a.v, b.v);}
+inline float_4 fmax(const float_4 &a, const float_4 &b) {return _mm_max_ps(a.v, b.v);}
+inline float_4 sqrt(const float_4 &a) {return _mm_sqrt_ps(a.v);}
+#if defined(__SSE4_1__)
+inline float_4 floor(const float_4 &a) {return _mm_floor_ps(a.v);}
+#else
+inline float_4 floor(const float_4 &a) {
+	// Truncate, then subtract 1 where truncation rounded up
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.f)));
+}
+#endif
+inline int movemask(const float_4 &a) {return _mm_movemask_ps(a.v);}
+
+inline int32_4 operator+(const int32_4 &a, const int32_4 &b) {return _mm_add_epi32(a.v, b.v);}
+inline int32_4 operator-(const int32_4 &a, const int32_4 &b) {return _mm_sub_epi32(a.v, b.v);}
+inline int32_4 operator-(const int32_4 &a) {return _mm_sub_epi32(_mm_setzero_si128(), a.v);}
+inline int32_4 operator==(const int32_4 &a, const int32_4 &b) {return _mm_cmpeq_epi32(a.v, b.v);}
+inline int32_4 operator<(const int32_4 &a, const int32_4 &b) {return _mm_cmplt_epi32(a.v, b.v);}
+inline int32_4 operator>(const int32_4 &a, const int32_4 &b) {return _mm_cmpgt_epi32(a.v, b.v);}
+inline int32_4 operator&(const int32_4 &a, const int32_4 &b) {return _mm_and_si128(a.v, b.v);}
+inline int32_4 operator|(const int32_4 &a, const int32_4 &b) {return _mm_or_si128(a.v, b.v);}
+inline int32_4 operator^(const int32_4 &a, const int32_4 &b) {return _mm_xor_si128(a.v, b.v);}
+inline int32_4 andnot(const int32_4 &a, const int32_4 &b) {return _mm_andnot_si128(a.v, b.v);}
+inline int32_4 operator<<(const int32_4 &a, int b) {return _mm_slli_epi32(a.v, b);}
+inline int32_4 operator>>(const int32_4 &a, int b) {return _mm_srai_epi32(a.v, b);}
+inline int movemask(const int32_4 &a) {return _mm_movemask_ps(_mm_castsi128_ps(a.v));}
+
+inline int32_4 toInt(const float_4 &a) {return _mm_cvttps_epi32(a.v);}
+inline float_4 toFloat(const int32_4 &a) {return _mm_cvtepi32_ps(a.v);}
+inline float_4 bitsToFloat(const int32_4 &a) {return _mm_castsi128_ps(a.v);}
+inline int32_4 floatToBits(const float_4 &a) {return _mm_castps_si128(a.v);}
+
+#endif
+
+
+////////////////////
+// AVX
+////////////////////
+
+#if RACK_SIMD_AVX
+
+template <>
+struct Vector<float, 8> {
+	union {
+		__m256 v;
+		float s[8];
+	};
+
+	Vector() {}
+	Vector(float x) {
+		v = _mm256_set1_ps(x);
+	}
+	Vector(__m256 v) : v(v) {}
+	static Vector load(const float *x) {
+		return Vector(_mm256_loadu_ps(x));
+	}
+	void store(float *x) const {
+		_mm256_storeu_ps(x, v);
+	}
+	static Vector mask() {
+		return Vector(_mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+	}
+	float &operator[](int i) {
+		return s[i];
+	}
+	const float &operator[](int i) const {
+		return s[i];
+	}
+};
+
+inline float_8 operator+(const float_8 &a, const float_8 &b) {return _mm256_add_ps(a.v, b.v);}
+inline float_8 operator-(const float_8 &a, const float_8 &b) {return _mm256_sub_ps(a.v, b.v);}
+inline float_8 operator*(const float_8 &a, const float_8 &b) {return _mm256_mul_ps(a.v, b.v);}
+inline float_8 operator/(const float_8 &a, const float_8 &b) {return _mm256_div_ps(a.v, b.v);}
+inline float_8 operator-(const float_8 &a) {return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.f));}
+inline float_8 operator==(const float_8 &a, const float_8 &b) {return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ);}
+inline float_8 operator!=(const float_8 &a, const float_8 &b) {return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ);}
+inline float_8 operator<(const float_8 &a, const float_8 &b) {return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ);}
+inline float_8 operator<=(const float_8 &a, const float_8 &b) {return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ);}
+inline float_8 operator>(const float_8 &a, const float_8 &b) {return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ);}
+inline float_8 operator>=(const float_8 &a, const float_8 &b) {return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ);}
+inline float_8 operator&(const float_8 &a, const float_8 &b) {return _mm256_and_ps(a.v, b.v);}
+inline float_8 operator|(const float_8 &a, const float_8 &b) {return _mm256_or_ps(a.v, b.v);}
+inline float_8 operator^(const float_8 &a, const float_8 &b) {return _mm256_xor_ps(a.v, b.v);}
+inline float_8 andnot(const float_8 &a, const float_8 &b) {return _mm256_andnot_ps(a.v, b.v);}
+inline float_8 fmin(const float_8 &a, const float_8 &b) {return _mm256_min_ps(a.v, b.v);}
+inline float_8 fmax(const float_8 &a, const float_8 &b) {return _mm256_max_ps(a.v, b.v);}
+inline float_8 sqrt(const float_8 &a) {return _mm256_sqrt_ps(a.v);}
+inline float_8 floor(const float_8 &a) {return _mm256_floor_ps(a.v);}
+inline int movemask(const float_8 &a) {return _mm256_movemask_ps(a.v);}
+
+// 8 lane integer arithmetic needs AVX2, so int32_8 otherwise uses the scalar fallback, converting lane by lane
+#if defined(__AVX2__)
+
+template <>
+struct Vector<int32_t, 8> {
+	union {
+		__m256i v;
+		int32_t s[8];
+	};
+
+	Vector() {}
+	Vector(int32_t x) {
+		v = _mm256_set1_epi32(x);
+	}
+	Vector(__m256i v) : v(v) {}
+	static Vector load(const int32_t *x) {
+		return Vector(_mm256_loadu_si256((const __m256i*) x));
+	}
+	void store(int32_t *x) const {
+		_mm256_storeu_si256((__m256i*) x, v);
+	}
+	static Vector mask() {
+		return Vector(_mm256_set1_epi32(-1));
+	}
+	int32_t &operator[](int i) {
+		return s[i];
+	}
+	const int32_t &operator[](int i) const {
+		return s[i];
+	}
+};
+
+inline int32_8 operator+(const int32_8 &a, const int32_8 &b) {return _mm256_add_epi32(a.v, b.v);}
+inline int32_8 operator-(const int32_8 &a, const int32_8 &b) {return _mm256_sub_epi32(a.v, b.v);}
+inline int32_8 operator*(const int32_8 &a, const int32_8 &b) {return _mm256_mullo_epi32(a.v, b.v);}
+inline int32_8 operator-(const int32_8 &a) {return _mm256_sub_epi32(_mm256_setzero_si256(), a.v);}
+inline int32_8 operator==(const int32_8 &a, const int32_8 &b) {return _mm256_cmpeq_epi32(a.v, b.v);}
+inline int32_8 operator<(const int32_8 &a, const int32_8 &b) {return _mm256_cmpgt_epi32(b.v, a.v);}
+inline int32_8 operator>(const int32_8 &a, const int32_8 &b) {return _mm256_cmpgt_epi32(a.v, b.v);}
+inline int32_8 operator&(const int32_8 &a, const int32_8 &b) {return _mm256_and_si256(a.v, b.v);}
+inline int32_8 operator|(const int32_8 &a, const int32_8 &b) {return _mm256_or_si256(a.v, b.v);}
+inline int32_8 operator^(const int32_8 &a, const int32_8 &b) {return _mm256_xor_si256(a.v, b.v);}
+inline int32_8 andnot(const int32_8 &a, const int32_8 &b) {return _mm256_andnot_si256(a.v, b.v);}
+inline int32_8 operator<<(const int32_8 &a, int b) {return _mm256_slli_epi32(a.v, b);}
+inline int32_8 operator>>(const int32_8 &a, int b) {return _mm256_srai_epi32(a.v, b);}
+inline int movemask(const int32_8 &a) {return _mm256_movemask_ps(_mm256_castsi256_ps(a.v));}
+
+inline int32_8 toInt(const float_8 &a) {return _mm256_cvttps_epi32(a.v);}
+inline float_8 toFloat(const int32_8 &a) {return _mm256_cvtepi32_ps(a.v);}
+inline float_8 bitsToFloat(const int32_8 &a) {return _mm256_castsi256_ps(a.v);}
+inline int32_8 floatToBits(const float_8 &a) {return _mm256_castps_si256(a.v);}
+
+#endif
+
+#endif
+
+
+////////////////////
+// Operators with scalars and compound assignment
+////////////////////
+
+template <typename T, int N>
+inline Vector<T, N> operator+(const Vector<T, N> &a, T b) {return a + Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> operator+(T a, const Vector<T, N> &b) {return Vector<T, N>(a) + b;}
+template <typename T, int N>
+inline Vector<T, N> operator-(const Vector<T, N> &a, T b) {return a - Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> operator-(T a, const Vector<T, N> &b) {return Vector<T, N>(a) - b;}
+template <typename T, int N>
+inline Vector<T, N> operator*(const Vector<T, N> &a, T b) {return a * Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> operator*(T a, const Vector<T, N> &b) {return Vector<T, N>(a) * b;}
+template <typename T, int N>
+inline Vector<T, N> operator/(const Vector<T, N> &a, T b) {return a / Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> operator/(T a, const Vector<T, N> &b) {return Vector<T, N>(a) / b;}
+template <typename T, int N>
+inline Vector<T, N> operator<(const Vector<T, N> &a, T b) {return a < Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> operator<=(const Vector<T, N> &a, T b) {return a <= Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> operator>(const Vector<T, N> &a, T b) {return a > Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> operator>=(const Vector<T, N> &a, T b) {return a >= Vector<T, N>(b);}
+
+template <typename T, int N>
+inline Vector<T, N> &operator+=(Vector<T, N> &a, const Vector<T, N> &b) {return a = a + b;}
+template <typename T, int N>
+inline Vector<T, N> &operator-=(Vector<T, N> &a, const Vector<T, N> &b) {return a = a - b;}
+template <typename T, int N>
+inline Vector<T, N> &operator*=(Vector<T, N> &a, const Vector<T, N> &b) {return a = a * b;}
+template <typename T, int N>
+inline Vector<T, N> &operator/=(Vector<T, N> &a, const Vector<T, N> &b) {return a = a / b;}
+template <typename T, int N>
+inline Vector<T, N> &operator+=(Vector<T, N> &a, T b) {return a = a + Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> &operator-=(Vector<T, N> &a, T b) {return a = a - Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> &operator*=(Vector<T, N> &a, T b) {return a = a * Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> &operator/=(Vector<T, N> &a, T b) {return a = a / Vector<T, N>(b);}
+template <typename T, int N>
+inline Vector<T, N> operator~(const Vector<T, N> &a) {return a ^ Vector<T, N>::mask();}
+
+
+////////////////////
+// Math functions
+////////////////////
+
+// Scalar versions, so templated DSP code can use the same calls for `float` and vectors
+using rack::clamp;
+
+inline float ifelse(bool cond, float a, float b) {
+	return cond ? a : b;
+}
+
+/** Returns `a` in lanes where `mask` is true and `b` elsewhere */
+template <typename T, int N>
+inline Vector<T, N> ifelse(const Vector<T, N> &mask, const Vector<T, N> &a, const Vector<T, N> &b) {
+	return (mask & a) | andnot(mask, b);
+}
+
+/** Limits `x` between `a` and `b`. Assumes a <= b. */
+template <typename T, int N>
+inline Vector<T, N> clamp(const Vector<T, N> &x, const Vector<T, N> &a, const Vector<T, N> &b) {
+	return fmin(fmax(x, a), b);
+}
+
+/** Maps `x` linearly from the range [xMin, xMax] to [yMin, yMax] */
+template <typename T, int N>
+inline Vector<T, N> rescale(const Vector<T, N> &x, T xMin, T xMax, T yMin, T yMax) {
+	return Vector<T, N>(yMin) + (x - Vector<T, N>(xMin)) * ((yMax - yMin) / (xMax - xMin));
+}
+
+template <int N>
+inline Vector<float, N> fabs(const Vector<float, N> &x) {
+	return andnot(Vector<float, N>(-0.f), x);
+}
+
+/** Returns 2^x, with relative error under 1e-6 for x in [-126, 126] */
+template <int N>
+inline Vector<float, N> exp2(const Vector<float, N> &x) {
+	typedef Vector<float, N> V;
+	V xc = clamp(x, V(-126.f), V(126.f));
+	// Split into an integer exponent and a fraction in [-0.5, 0.5]
+	V xi = floor(xc + V(0.5f));
+	V f = xc - xi;
+	// Taylor series of 2^f = e^(f ln 2)
+	V y = V(1.5403530e-4f);
+	y = y * f + V(1.3333558e-3f);
+	y = y * f + V(9.6181291e-3f);
+	y = y * f + V(5.5504109e-2f);
+	y = y * f + V(2.4022651e-1f);
+	y = y * f + V(6.9314718e-1f);
+	y = y * f + V(1.f);
+	// Build 2^xi from its floating point exponent bits
+	Vector<int32_t, N> e = (toInt(xi) + Vector<int32_t, N>(127)) << 23;
+	return y * bitsToFloat(e);
+}
+
+/** Returns sin(x), with absolute error under 1e-6 for x in [-10, 10]. The error grows with |x| from the range reduction. */
+template <int N>
+inline Vector<float, N> sin(const Vector<float, N> &x) {
+	typedef Vector<float, N> V;
+	const float pi = M_PI;
+	// Reduce to [-pi, pi]
+	V r = x - V(2 * pi) * floor(x * V(0.5f / pi) + V(0.5f));
+	// Reflect to [-pi/2, pi/2] using sin(pi - r) = sin(r)
+	V sign = r & V(-0.f);
+	V a = fabs(r);
+	a = ifelse(a > V(pi / 2), V(pi) - a, a);
+	// Taylor series up to x^11
+	V a2 = a * a;
+	V y = V(-2.5052108e-8f);
+	y = y * a2 + V(2.7557319e-6f);
+	y = y * a2 + V(-1.9841270e-4f);
+	y = y * a2 + V(8.3333333e-3f);
+	y = y * a2 + V(-1.6666667e-1f);
+	y = y * a2 + V(1.f);
+	return (y * a) ^ sign;
+}
+
+/** Returns tanh(x), with absolute error under 1e-6 */
+template <int N>
+inline Vector<float, N> tanh(const Vector<float, N> &x) {
+	typedef Vector<float, N> V;
+	// tanh(x) = (e^2x - 1) / (e^2x + 1), saturating where the result rounds to +-1 anyway
+	V xc = clamp(x, V(-9.f), V(9.f));
+	V e = exp2(xc * V(2.f * (float) M_LOG2E));
+	return (e - V(1.f)) / (e + V(1.f));
+}
+
+
+} // namespace simd
+} // namespace rack
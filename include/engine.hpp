@@ -1,12 +1,23 @@
 #pragma once
 #include <vector>
 #include "util/common.hpp"
+#include "profiler.hpp"
+#include "arena.hpp"
+#include "midi.hpp"
 #include <jansson.h>
 
 
 namespace rack {
 
 
+/** The largest number of frames the engine passes to Module::process() at once */
+static const int ENGINE_MAX_BLOCK_SIZE = 256;
+/** The largest number of channels a polyphonic port can carry */
+static const int PORT_MAX_CHANNELS = 16;
+/** The largest factor a module can be oversampled by */
+static const int MODULE_MAX_OVERSAMPLE = 8;
+
+
 struct Param {
 	float value = 0.0;
 };
@@ -27,27 +38,103 @@ struct Light {
 
 
 struct Input {
-	/** Voltage of the port, zero if not plugged in. Read-only by Module */
-	float value = 0.0;
+	union {
+		/** Voltages of each channel, zero if not plugged in. Read-only by Module */
+		alignas(16) float voltages[PORT_MAX_CHANNELS] = {};
+		/** Voltage of the first channel, zero if not plugged in. Read-only by Module */
+		float value;
+	};
+	/** Number of channels of the wire plugged in, at most `maxChannels`, or 0 if not plugged in */
+	int channels = 0;
+	/** The most channels the input reads, from 1 to PORT_MAX_CHANNELS. Set in the constructor before the module is added to the engine, which allocates a block for each.
+Wires carrying more channels are cut to this many, so a monophonic input reads the first channel.
+*/
+	int maxChannels = 1;
+	/** Voltages of each channel for each frame of the current block, used by Module::process(). The block of channel `c` starts at `buffer + c * ENGINE_MAX_BLOCK_SIZE`. Read-only by Module */
+	float *buffer = NULL;
 	/** Whether a wire is plugged in */
 	bool active = false;
+	/** Whether any channel of the block differs from the previous block. Modules can skip work while none of their inputs have changed */
+	bool changed = true;
 	Light plugLights[2];
+	/** Positive and negative peaks of the blocks since the plug lights were last updated, kept by the engine */
+	float plugPeaks[2] = {};
 	/** Returns the value if a wire is plugged in, otherwise returns the given default value */
 	float normalize(float normalValue) {
 		return active ? value : normalValue;
 	}
+	float getVoltage(int channel = 0) {
+		return voltages[channel];
+	}
+	/** Returns the voltage of `channel`, or of the first channel if the wire is monophonic, so mono inputs apply to every voice */
+	float getPolyVoltage(int channel) {
+		return (channels == 1) ? value : voltages[channel];
+	}
+	/** Returns the block of `channel` */
+	float *getBuffer(int channel = 0) {
+		return buffer + channel * ENGINE_MAX_BLOCK_SIZE;
+	}
+	/** Returns the block of `channel`, or of the first channel if the wire is monophonic */
+	float *getPolyBuffer(int channel) {
+		return (channels == 1) ? buffer : getBuffer(channel);
+	}
+	bool isPolyphonic() {
+		return channels > 1;
+	}
 };
 
 
 struct Output {
-	/** Voltage of the port. Write-only by Module */
-	float value = 0.0;
+	union {
+		/** Voltages of each channel. Write-only by Module */
+		alignas(16) float voltages[PORT_MAX_CHANNELS] = {};
+		/** Voltage of the first channel. Write-only by Module */
+		float value;
+	};
+	/** Number of channels carried to inputs by wires, each every frame by its block in `buffer` */
+	int channels = 1;
+	/** The most channels the output carries, from 1 to PORT_MAX_CHANNELS. Set in the constructor before the module is added to the engine, which allocates a block for each */
+	int maxChannels = 1;
+	/** Voltages of each channel for each frame of the current block, used by Module::process(). The block of channel `c` starts at `buffer + c * ENGINE_MAX_BLOCK_SIZE`. Write-only by Module */
+	float *buffer = NULL;
 	/** Whether a wire is plugged in */
 	bool active = false;
+	/** Whether any frame of a channel's block differs from the last frame of the channel's previous block, set by the engine after the module is processed.
+Wires skip copying outputs which haven't changed.
+*/
+	bool changed = true;
+	/** The last voltage of each channel's previous block, for detecting changes */
+	float lastVoltages[PORT_MAX_CHANNELS] = {};
 	Light plugLights[2];
+	/** Positive and negative peaks of the blocks since the plug lights were last updated, kept by the engine */
+	float plugPeaks[2] = {};
+	void setVoltage(float voltage, int channel = 0) {
+		voltages[channel] = voltage;
+	}
+	/** Returns the block of `channel` */
+	float *getBuffer(int channel = 0) {
+		return buffer + channel * ENGINE_MAX_BLOCK_SIZE;
+	}
+	/** Sets the number of channels, from 1 to `maxChannels`. Unused channels are set to 0V. */
+	void setChannels(int channels) {
+		channels = clamp(channels, 1, maxChannels);
+		for (int c = channels; c < this->channels; c++) {
+			voltages[c] = 0.f;
+		}
+		this->channels = channels;
+	}
+	bool isPolyphonic() {
+		return channels > 1;
+	}
 };
 
 
+struct ModuleOversampler;
+
+
+/** Modules and their port buffers are allocated from the engine arena in the order they are created, so modules stepped together sit together in memory and are recycled without fragmenting the heap.
+The number of params, ports, and lights is fixed once the module is added to the engine, and must not be resized after.
+*/
 struct Module {
 	std::vector<Param> params;
 	std::vector<Input> inputs;
@@ -55,6 +142,29 @@ struct Module {
 	std::vector<Light> lights;
 	/** For CPU usage meter */
 	float cpuTime = 0.0;
+	/** Sampled step times in cycles per frame, recorded while the power meter is enabled */
+	ProfilerHistogram profile;
+	/** Storage for the `buffer` of each input and output, allocated by the engine */
+	ArenaVector<float> portBuffers;
+	/** Set in the constructor if the module has no effects besides writing its outputs, such as an oscillator without lights.
+The engine then skips the module while none of its outputs are plugged in.
+*/
+	bool outputOnly = false;
+	/** Set in the constructor if the module's outputs and lights depend only on its inputs and params, such as a mixer or a quantizer.
+The engine then skips the module while its inputs, params, and outputs are unchanged since the previous block.
+Params must be set with engineSetParam() or engineSetParamSmooth() for the engine to notice.
+*/
+	bool stateless = false;
+	/** Set by the engine when a param, the sample rate, or the oversampling factor changes, and cleared after the module is processed */
+	bool paramsChanged = true;
+	/** The number of frames at the start of each output block which hold the stateless module's last voltages, kept by the engine so it only skips blocks no longer than that */
+	int steadyFrames = 0;
+	/** Whether the user has taken the module out of the engine, which sets its outputs to 0V. Set with engineSetModuleBypass() */
+	bool bypassed = false;
+	/** Number of times the module is stepped per engine frame, 1, 2, 4, or 8. Set with engineSetModuleOversample() */
+	int oversample = 1;
+	/** Resampling state of the ports while oversampled, owned by the engine */
+	ModuleOversampler *oversampler = NULL;
 
 	/** Constructs a Module with no params, inputs, outputs, and lights */
 	Module() {}
@@ -66,15 +176,28 @@ struct Module {
 		lights.resize(numLights);
 	}
 	virtual ~Module() {}
+	static void *operator new(size_t size) {
+		return arenaAlloc(size);
+	}
+	static void operator delete(void *p, size_t size) {
+		arenaFree(p, size);
+	}
 
 	/** Advances the module by 1 audio frame with duration 1.0 / gSampleRate
 	Override this method to read inputs and params, and to write outputs and lights.
 	*/
 	virtual void step() {}
+	/** Advances the module by `frames` audio frames, at most ENGINE_MAX_BLOCK_SIZE.
+	Override this method to read `inputs[i].getBuffer(c)` and write `outputs[i].getBuffer(c)` in a tight loop, for each channel `c`.
+	The default implementation calls step() once per frame, so per-sample modules do not need to override it.
+	*/
+	virtual void process(int frames);
 
 	/** Called when the engine sample rate is changed
 	*/
 	virtual void onSampleRateChange() {}
+	/** Called at the frame of a message sent with engineSendMidiMessage() */
+	virtual void onMidiMessage(MidiMessage message) {}
 	/** Deprecated */
 	virtual void onCreate() {}
 	/** Deprecated */
@@ -107,6 +230,36 @@ struct Wire {
 	Module *inputModule = NULL;
 	int inputId;
 	void step();
+	/** Copies the output's block of each channel to the input */
+	void stepBlock(int frames);
+};
+
+
+/** Work the engine has avoided because signals didn't change, counted while the power meter is enabled */
+struct EngineChangeCounts {
+	/** Blocks copied along wires */
+	uint64_t wireCopies = 0;
+	/** Blocks not copied along wires because the output was unchanged */
+	uint64_t wireSkips = 0;
+	/** Blocks processed by stateless modules */
+	uint64_t statelessSteps = 0;
+	/** Blocks skipped by stateless modules because nothing changed */
+	uint64_t statelessSkips = 0;
+};
+
+
+/** Options for giving the engine's threads priority over the rest of the system, all off by default.
+Changes take effect the next time the engine is started.
+*/
+struct EngineRealtimeSettings {
+	/** Requests SCHED_FIFO scheduling for the engine, worker, and audio device threads, or time-critical priority on Windows */
+	bool realtime = false;
+	/** SCHED_FIFO priority, from 1 to 99 */
+	int priority = 80;
+	/** CPUs to pin threads to, one each in turn starting with the engine thread, or empty to let the OS choose. Each must be less than engineGetMaxCpus() */
+	std::vector<int> cpus;
+	/** Locks the process's memory into RAM with mlockall(), and pre-faults the stack of each engine thread, so stepping never waits on a page fault */
+	bool lockMemory = false;
 };
 
 
@@ -115,19 +268,102 @@ void engineDestroy();
 /** Launches engine thread */
 void engineStart();
 void engineStop();
+/** Makes `module` the engine clock, so its audio device callback steps the engine with engineClockStep() instead of the engine thread sleeping to keep time.
+Only one module can be the clock at a time. Returns whether `module` is the clock.
+*/
+bool engineClockAcquire(Module *module);
+/** Returns the engine to keeping time by itself if `module` is the clock */
+void engineClockRelease(Module *module);
+/** Returns the module which is the engine clock, or NULL */
+Module *engineGetClockModule();
+/** Steps exactly `frames` frames on the calling thread if `module` is the clock and the engine is running.
+Returns whether the frames were stepped.
+*/
+bool engineClockStep(Module *module, int frames);
+/** Steps the engine on the calling thread instead of launching the engine thread, for rendering patches offline faster than real time.
+Call engineRenderBlock() repeatedly between engineRenderStart() and engineRenderStop().
+*/
+void engineRenderStart();
+/** Steps one block of frames without waiting for the clock.
+Returns the number of frames stepped, which are available in the port buffers of each module until the next call.
+*/
+int engineRenderBlock();
+void engineRenderStop();
 /** Does not transfer pointer ownership */
 void engineAddModule(Module *module);
 void engineRemoveModule(Module *module);
+/** Calls the module's onReset() on the engine thread before the next block */
 void engineResetModule(Module *module);
+/** Calls the module's onRandomize() on the engine thread before the next block */
 void engineRandomizeModule(Module *module);
+/** Calls the module's onMidiMessage() at engine frame `frame`, or before the next block if `frame` has passed. Can be called from any thread.
+Messages sent after the module is removed are dropped.
+*/
+void engineSendMidiMessage(Module *module, MidiMessage message, int64_t frame = 0);
+/** Stops stepping `module` and sets its outputs to 0V, or steps it again if `bypassed` is false */
+void engineSetModuleBypass(Module *module, bool bypassed);
+/** Steps `module` `oversample` times per frame, upsampling every channel of its inputs and decimating every channel of its outputs.
+While stepped, engineGetSampleRate() and engineGetSampleTime() return the oversampled rate, and onSampleRateChange() is called when the factor changes.
+*/
+void engineSetModuleOversample(Module *module, int oversample);
 /** Does not transfer pointer ownership */
 void engineAddWire(Wire *wire);
 void engineRemoveWire(Wire *wire);
-void engineSetParam(Module *module, int paramId, float value);
-void engineSetParamSmooth(Module *module, int paramId, float value);
+/** Sets a param at engine frame `frame`, or before the next block if `frame` has passed.
+Block-based modules see the change at that frame, since Module::process() is split into slices around it.
+Like all events, waits rather than dropping the change if the engine thread has fallen behind. Can be called from any thread.
+*/
+void engineSetParam(Module *module, int paramId, float value, int64_t frame = 0);
+/** Moves a param toward `value` with exponential decay rate `lambda` in 1/seconds.
+Any number of params can be smoothed at once. Can be called from any thread.
+Waits rather than dropping the change if the engine thread has fallen behind, and jumps to the value with engineSetParam() if the engine is not running.
+The default decay rate is about 1 graphics frame.
+*/
+void engineSetParamSmooth(Module *module, int paramId, float value, float lambda = 60.f);
 void engineSetSampleRate(float sampleRate);
+/** Sets the number of threads which step modules, including the engine thread.
+With 1 thread, all modules are stepped on the engine thread as before.
+Takes effect before the next block of frames.
+*/
+void engineSetThreadCount(int threadCount);
+int engineGetThreadCount();
+/** Returns the number of hardware threads available */
+int engineGetMaxThreadCount();
+/** Sets the number of frames the engine processes between cable updates, at most ENGINE_MAX_BLOCK_SIZE.
+Module::process() is called once per block, and cables have a delay of 1 block.
+The default block size of 1 steps modules and cables once per frame.
+Takes effect before the next block of frames.
+*/
+void engineSetBlockSize(int blockSize);
+int engineGetBlockSize();
+/** Returns a histogram of engine block times in cycles per frame, recorded while the power meter is enabled */
+const ProfilerHistogram &engineGetBlockProfile();
+/** Returns the number of profiled blocks which took longer to step than real time */
+int engineGetOverruns();
+/** Clears the engine and module profiles, and the change counts, before the next block */
+void engineResetProfile();
+EngineChangeCounts engineGetChangeCounts();
+void engineSetRealtimeSettings(const EngineRealtimeSettings &settings);
+const EngineRealtimeSettings &engineGetRealtimeSettings();
+/** Returns the number of CPUs the OS's thread affinity masks can hold, one more than the largest CPU threads can be pinned to */
+int engineGetMaxCpus();
+/** Returns the number of frames stepped before the current block, for timestamping events */
+int64_t engineGetFrame();
+/** Returns the module being stepped by the calling thread, or NULL */
+Module *engineGetSteppingModule();
+/** Returns the engine frame of the step() being run by the calling thread, for timestamping what a module reads from a device */
+int64_t engineGetStepFrame();
+/** Returns the engine frame matching the current time, estimated from when the engine last finished a block, plus a block of latency so the frame is not yet stepped.
+For timestamping messages arriving on a device thread, so they apply with a constant latency rather than all at the start of the next block.
+*/
+int64_t engineGetDeviceFrame();
+/** Returns 0 on the thread stepping the engine or any thread outside the engine, and the index of the worker from 1 to engineGetThreadCount() - 1 on worker threads.
+Only one thread at a time steps the engine, so the index names a single stepping thread at any moment.
+*/
+int engineGetThreadIndex();
+/** Returns the current sample rate, multiplied by the module's oversampling factor while an oversampled module is being stepped */
 float engineGetSampleRate();
-/** Returns the inverse of the current sample rate */
+/** Returns the inverse of engineGetSampleRate() */
 float engineGetSampleTime();
 
 
@@ -10,6 +10,9 @@
 namespace rack {
 
 
+struct Module;
+
+
 struct MidiMessage {
 	uint8_t cmd = 0x00;
 	uint8_t data1 = 0x00;
@@ -113,6 +116,10 @@ struct MidiInput : MidiIO {
 
 
 struct MidiInputQueue : MidiInput {
+	/** If set, messages are sent to the module's onMidiMessage() through the engine at the frame they arrived, instead of being queued for shift().
+	Not owned
+	*/
+	Module *module = NULL;
 	int queueMaxSize = 8192;
 	std::queue<MidiMessage> queue;
 	void onMessage(MidiMessage message) override;
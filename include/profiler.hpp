@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <jansson.h>
+#ifdef _MSC_VER
+	#include <intrin.h>
+#else
+	#include <x86intrin.h>
+#endif
+
+
+namespace rack {
+
+
+/** Returns a timestamp from the CPU's cycle counter, which is much cheaper to read than std::chrono clocks */
+inline uint64_t profilerCycles() {
+	return __rdtsc();
+}
+
+/** Returns the rate of the cycle counter in ticks per second, estimated against the system clock since launch */
+double profilerCyclesPerSecond();
+
+
+/** Log-scaled histogram of cycle counts with 4 bins per octave.
+Written by one thread at a time. Reading from another thread may see partially recorded samples, which is fine for display.
+*/
+struct ProfilerHistogram {
+	static const int BINS = 4 * 32;
+	uint32_t bins[BINS] = {};
+	uint32_t count = 0;
+	uint64_t max = 0;
+
+	void record(uint64_t cycles);
+	/** Returns the cycle count below which fraction `p` of recorded samples fall, rounded up to the edge of its bin */
+	uint64_t percentile(float p) const;
+	void reset();
+	/** Converts the cycle counts to seconds with `secondsPerCycle` */
+	json_t *toJson(double secondsPerCycle) const;
+};
+
+
+/** Writes the engine block and module profiles to a JSON file */
+void profilerSave(std::string filename);
+
+
+} // namespace rack
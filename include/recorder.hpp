@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "engine.hpp"
+#include "midi.hpp"
+
+
+namespace rack {
+
+
+/** Records everything fed into the engine to a binary file, so a session can be replayed offline to profile or bisect the exact workload.
+
+A recording starts with the patch, the sample rate, block size, and random seed.
+It then holds each input with the engine frame it arrived at:
+- param changes, resets, randomizations, MIDI messages, and sample rate changes sent through the engine's event API
+- param smoothing requests, at the block they were taken up
+- block size changes
+- messages shifted from a MidiInputQueue and device frames read by the Core AudioInterface, at the frame of the step which read them
+- a hash of every module output, every 4096 frames
+
+Replaying loads the patch and feeds its input back to the engine at the same frames, then checks the hashes for bit-identical output.
+Modules which draw random numbers while stepping are only deterministic with 1 engine thread.
+*/
+
+/** Reloads the patch so every module starts from its saved state, and starts recording to `filename`.
+Restarts the engine, so call from the UI thread while the engine is running. Returns false if the file can't be written.
+*/
+bool recorderStart(std::string filename);
+/** Finishes the recording. Editing the patch while recording stops the recording, since edits are not recorded. */
+void recorderStop();
+bool recorderIsRecording();
+/** Returns the number of frames recorded so far */
+int64_t recorderGetFrames();
+
+/** Loads the patch of the recording at `filename` into the rack, and sets the engine's sample rate, block size, and random seed to the recorded ones.
+Call before engineRenderStart(). Returns false if the file can't be read or some of its modules can't be loaded.
+*/
+bool recorderReplayStart(std::string filename);
+/** Sends the recorded input of the next block to the engine. Call before each engineRenderBlock(). */
+void recorderReplayBlock();
+/** Returns false if the output of the replay differed from the recording, logging the first frame where it did */
+bool recorderReplayStop();
+bool recorderIsReplaying();
+/** Returns the number of frames in the recording being replayed */
+int64_t recorderGetReplayFrames();
+
+/** Returns whether the engine should call the recorder, while recording or replaying */
+bool recorderIsActive();
+
+// Called by the engine thread
+void recorderParam(Module *module, int64_t frame, int paramId, float value);
+void recorderParamSmooth(Module *module, int64_t frame, int paramId, float value, float lambda);
+void recorderReset(Module *module, int64_t frame);
+void recorderRandomize(Module *module, int64_t frame);
+void recorderMidiMessage(Module *module, int64_t frame, MidiMessage message);
+void recorderSampleRate(int64_t frame, float sampleRate);
+void recorderBlockSize(int64_t frame, int blockSize);
+/** Accumulates the hash of the outputs of a block, and records or checks it every 4096 frames */
+void recorderBlock(int64_t frame, int frames, uint64_t outputHash);
+
+// Called while stepping the module reading a device, using engineGetSteppingModule() and engineGetStepFrame()
+/** Records a message shifted from a MidiInputQueue */
+void recorderMidiInput(MidiMessage message);
+/** Returns the next recorded message of the stepping module due by the step frame while replaying */
+bool recorderReplayMidiInput(MidiMessage *message);
+/** Records the voltages of a frame of up to 64 audio device inputs */
+void recorderAudioInput(const float *voltages, int channels);
+/** Writes the recorded voltages of the step frame while replaying, returning the number of channels */
+int recorderReplayAudioInput(float *voltages, int maxChannels);
+
+
+} // namespace rack
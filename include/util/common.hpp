@@ -476,6 +476,8 @@ DeferWrapper<F> deferWrapper(F f) {
 
 /** Seeds the RNG with the current time */
 void randomInit();
+/** Restarts the RNG from `seed`, so the same sequence of numbers can be drawn again */
+void randomSeed(uint64_t seed);
 /** Returns a uniform random uint32_t from 0 to UINT32_MAX */
 uint32_t randomu32();
 uint64_t randomu64();
@@ -121,6 +121,9 @@ struct NoteSeq : Module,QuantizeUtils {
 	PulseGenerator gatePulse;
 
 	NoteSeq() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+		// The bottom row also carries every row on one polyphonic cable
+		outputs[VOCT_MAIN_OUTPUT].maxChannels = POLY;
+		outputs[GATE_MAIN_OUTPUT].maxChannels = POLY;
 		reset();
 	}
 
@@ -202,13 +205,17 @@ struct NoteSeq : Module,QuantizeUtils {
 		// ////////////////////////////////////////////// POLY OUTPUTS //////////////////////////////////////////////
 		
 		int *polyYVals = getYValsFromBottomAtSeqPos(params[INCLUDE_INACTIVE_PARAM].value);
+		outputs[VOCT_MAIN_OUTPUT].setChannels(POLY);
+		outputs[GATE_MAIN_OUTPUT].setChannels(POLY);
 		for(int i=0;i<POLY;i++){ //param # starts from bottom
 			bool hasVal = polyYVals[i] > -1;
 			bool cellActive = hasVal && cells[iFromXY(seqPos, ROWS - polyYVals[i] - 1)];
 			if(cellActive){ 
 				outputs[VOCT_MAIN_OUTPUT + i].value = closestVoltageForRow(polyYVals[i]);
+				outputs[VOCT_MAIN_OUTPUT].setVoltage(closestVoltageForRow(polyYVals[i]), i);
 			}
 			outputs[GATE_MAIN_OUTPUT + i].value = pulse && cellActive ? 10.0 : 0.0;
+			outputs[GATE_MAIN_OUTPUT].setVoltage(pulse && cellActive ? 10.0 : 0.0, i);
 			lights[GATES_LIGHT + i].value = cellActive ? 1.0 : 0.0;
 		}
 
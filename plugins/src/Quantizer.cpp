@@ -21,7 +21,13 @@ struct Quantizer : Module,QuantizeUtils {
 		NUM_LIGHTS
 	};
 
-	Quantizer() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {}
+	Quantizer() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+		// The output only depends on the inputs and params
+		stateless = true;
+		// Each channel of a polyphonic input is quantized to the same channel of the output
+		inputs[VOLT_INPUT].maxChannels = PORT_MAX_CHANNELS;
+		outputs[VOLT_OUTPUT].maxChannels = PORT_MAX_CHANNELS;
+	}
 
 	void step() override;
 
@@ -37,7 +43,11 @@ struct Quantizer : Module,QuantizeUtils {
 void Quantizer::step() {
 	int rootNote = params[ROOT_NOTE_PARAM].value + rescalefjw(inputs[NOTE_INPUT].value, 0, 10, 0, QuantizeUtils::NUM_NOTES-1);
 	int scale = params[SCALE_PARAM].value + rescalefjw(inputs[SCALE_INPUT].value, 0, 10, 0, QuantizeUtils::NUM_SCALES-1);
-	outputs[VOLT_OUTPUT].value = closestVoltageInScale(inputs[VOLT_INPUT].value, rootNote, scale);
+	int channels = std::max(inputs[VOLT_INPUT].channels, 1);
+	outputs[VOLT_OUTPUT].setChannels(channels);
+	for (int c = 0; c < channels; c++) {
+		outputs[VOLT_OUTPUT].setVoltage(closestVoltageInScale(inputs[VOLT_INPUT].getVoltage(c), rootNote, scale), c);
+	}
 }
 
 struct QuantizerWidget : ModuleWidget { 
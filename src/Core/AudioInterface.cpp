@@ -1,139 +1,317 @@
 #include <assert.h>
-#include <mutex>
+#include <atomic>
 #include <chrono>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
 #include "Core.hpp"
 #include "audio.hpp"
 #include "dsp/resampler.hpp"
 #include "dsp/ringbuffer.hpp"
+#include "recorder.hpp"
 
 
-#define AUDIO_OUTPUTS 8
-#define AUDIO_INPUTS 8
+/** Ports of each direction of the Audio module */
+#define AUDIO_CHANNELS 8
+/** Ports of each direction of the Audio-64 module, which opens up to its chosen number of them */
+#define AUDIO_MAX_CHANNELS 64
+/** Device FIFOs hold this many device blocks, and at least 1024 frames */
+#define AUDIO_FIFO_BLOCKS 8
 
 
 using namespace rack;
 
 
+/** Waits on the engine thread until `cond` returns true, giving up after `timeout`.
+The device callback never takes a lock or notifies the engine, so this polls, yielding at first and then sleeping.
+*/
+template <typename F>
+static bool waitFor(F cond, std::chrono::milliseconds timeout) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	while (!cond()) {
+		auto elapsed = std::chrono::high_resolution_clock::now() - startTime;
+		if (elapsed >= timeout)
+			return false;
+		if (elapsed < std::chrono::microseconds(200))
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+	return true;
+}
+
+
+/** Fine-tunes the ratio of a SampleRateConverter so the FIFO between it and a device stays at a target fill level, following the drift between the device's clock and the engine's.
+A PI controller acts on the lowpassed fill level, so its integral converges to the drift between the clocks.
+*/
+struct DriftController {
+	/** Seconds to average the sawtooth of block transfers out of the fill level */
+	static constexpr double fillTau = 0.5;
+	/** Gains for a natural frequency of sqrt(ki) = 0.126 rad/s (0.02 Hz) and a damping ratio of kp / (2 sqrt(ki)) = 0.71, so a change in drift overshoots by about 4% and decays with a time constant of about 11 seconds */
+	static constexpr double kp = 0.178;
+	static constexpr double ki = 0.0158;
+	/** Clock crystals drift by about 100 ppm, so anything beyond this is a stalled stream rather than drift */
+	static constexpr double maxCorrection = 0.005;
+
+	bool started = false;
+	/** Lowpassed difference between the fill level and the target, in seconds */
+	double error = 0.0;
+	double integral = 0.0;
+	/** The factor to multiply the resampling ratio by, rounded to 1 ppm */
+	double correction = 1.0;
+
+	void reset() {
+		started = false;
+		error = 0.0;
+		integral = 0.0;
+		correction = 1.0;
+	}
+
+	/** `fill` and `target` are in frames at the device's sample rate.
+	The correction is positive when the FIFO fills up, so it speeds up the side of the converter which empties it.
+	*/
+	void process(int fill, int target, int deviceRate, float deltaTime) {
+		double e = (double) (fill - target) / deviceRate;
+		if (!started) {
+			error = e;
+			started = true;
+		}
+		else {
+			error += (e - error) * fmin(deltaTime / fillTau, 1.0);
+		}
+		integral = fmax(fmin(integral + error * deltaTime, maxCorrection / ki), -maxCorrection / ki);
+		double c = fmax(fmin(kp * error + ki * integral, maxCorrection), -maxCorrection);
+		correction = 1.0 + round(c * 1e6) / 1e6;
+	}
+};
+
+
 struct AudioInterfaceIO : AudioIO {
-	std::mutex engineMutex;
-	std::condition_variable engineCv;
-	std::mutex audioMutex;
-	std::condition_variable audioCv;
 	// Audio thread produces, engine thread consumes
-	DoubleRingBuffer<Frame<AUDIO_INPUTS>, (1<<15)> inputBuffer;
+	SPSCRingBuffer<float> inputBuffer;
 	// Audio thread consumes, engine thread produces
-	DoubleRingBuffer<Frame<AUDIO_OUTPUTS>, (1<<15)> outputBuffer;
-	bool active = false;
+	SPSCRingBuffer<float> outputBuffer;
+	/** The block size the FIFOs were sized for */
+	int fifoBlockSize = 0;
+	/** The FIFOs are reallocated by the UI thread when the stream opens with new channels or a new block size.
+	Each thread sets its flag before checking fifoReady, and resizeFifos() clears fifoReady before checking both flags, so with sequentially consistent atomics no thread uses the FIFOs while they are reallocated.
+	*/
+	std::atomic<bool> fifoReady;
+	std::atomic<bool> engineUsing;
+	std::atomic<bool> callbackUsing;
+	/** Set by the audio thread on each callback, and cleared by the engine thread when it gives up on the device */
+	std::atomic<bool> active;
+	/** The module which owns this device, used as the engine clock */
+	Module *module = NULL;
+	// Device buffers of the current callback while this device steps the engine
+	const float *clockInput = NULL;
+	float *clockOutput = NULL;
+	int clockFrames = 0;
+	int clockFrame = 0;
+
+	AudioInterfaceIO() : fifoReady(false), engineUsing(false), callbackUsing(false), active(false) {}
 
 	~AudioInterfaceIO() {
-		// Close stream here before destructing AudioInterfaceIO, so the mutexes are still valid when waiting to close.
+		// Close stream here before destructing AudioInterfaceIO, so the buffers are still valid until the callback has stopped.
 		setDevice(-1, 0);
 	}
 
+	bool isEngineClock(int sampleRate) override {
+		// processStream() acquires the clock if no other module holds it
+		Module *clockModule = engineGetClockModule();
+		return sampleRate == (int) engineGetSampleRate() && (!clockModule || clockModule == module);
+	}
+
 	void processStream(const float *input, float *output, int frames) override {
-		// Reactivate idle stream
+		// The first device running at the engine's sample rate steps the engine directly from its callback
+		if (sampleRate == (int) engineGetSampleRate() && engineClockAcquire(module)) {
+			// Silence the output in case the engine is paused or not running
+			if (numOutputs > 0)
+				memset(output, 0, frames * numOutputs * sizeof(float));
+			clockInput = input;
+			clockOutput = output;
+			clockFrame = 0;
+			clockFrames = frames;
+			// Each input frame is output by the same callback
+			stats.latency = (numInputs > 0 && numOutputs > 0) ? 2 * frames : 0;
+			stats.inputRatio = 1.0;
+			stats.outputRatio = 1.0;
+			engineClockStep(module, frames);
+			clockFrames = 0;
+			return;
+		}
+		engineClockRelease(module);
+
+		// The stream may be closing, so read its channels once, and only exchange frames with FIFOs of the same channels
+		int numInputs = this->numInputs;
+		int numOutputs = this->numOutputs;
+		callbackUsing = true;
+		if (!fifoReady) {
+			callbackUsing = false;
+			if (numOutputs > 0)
+				memset(output, 0, frames * numOutputs * sizeof(float));
+			return;
+		}
+
+		// Reactivate idle stream.
+		// Each FIFO is only cleared by its consumer, so the engine clears the input FIFO while the stream is idle.
 		if (!active) {
-			active = true;
-			inputBuffer.clear();
 			outputBuffer.clear();
+			active = true;
 		}
 
-		if (numInputs > 0) {
-			// TODO Do we need to wait on the input to be consumed here? Experimentally, it works fine if we don't.
-			for (int i = 0; i < frames; i++) {
-				if (inputBuffer.full())
+		if (numInputs > 0 && numInputs == (int) inputBuffer.stride()) {
+			// Push the block, in two parts if it wraps around the end of the FIFO
+			for (int i = 0; i < frames;) {
+				int n = std::min((int) inputBuffer.endCapacity(), frames - i);
+				if (n == 0) {
+					// Drop the rest of the block
+					stats.overruns++;
+					stats.recordXrun();
 					break;
-				Frame<AUDIO_INPUTS> inputFrame;
-				memset(&inputFrame, 0, sizeof(inputFrame));
-				memcpy(&inputFrame, &input[numInputs * i], numInputs * sizeof(float));
-				inputBuffer.push(inputFrame);
+				}
+				memcpy(inputBuffer.endData(), &input[numInputs * i], n * numInputs * sizeof(float));
+				inputBuffer.endIncr(n);
+				i += n;
 			}
+			stats.inputFill.record(inputBuffer.size());
 		}
 
 		if (numOutputs > 0) {
-			std::unique_lock<std::mutex> lock(audioMutex);
-			auto cond = [&] {
-				return (outputBuffer.size() >= (size_t) frames);
-			};
-			auto timeout = std::chrono::milliseconds(100);
-			if (audioCv.wait_for(lock, timeout, cond)) {
-				// Consume audio block
-				for (int i = 0; i < frames; i++) {
-					Frame<AUDIO_OUTPUTS> f = outputBuffer.shift();
-					for (int j = 0; j < numOutputs; j++) {
-						output[numOutputs*i + j] = clamp(f.samples[j], -1.f, 1.f);
+			// Never wait for the engine.
+			// If it hasn't produced a whole block, play silence and leave its frames for the next callback, so the FIFO refills a block of margin.
+			size_t fill = outputBuffer.size();
+			stats.outputFill.record(fill);
+			if (numOutputs == (int) outputBuffer.stride() && fill >= (size_t) frames) {
+				for (int i = 0; i < frames;) {
+					int n = std::min((int) outputBuffer.startSize(), frames - i);
+					const float *f = outputBuffer.startData();
+					for (int j = 0; j < n * numOutputs; j++) {
+						output[numOutputs * i + j] = clamp(f[j], -1.f, 1.f);
 					}
+					outputBuffer.startIncr(n);
+					i += n;
 				}
 			}
 			else {
-				// Timed out, fill output with zeros
 				memset(output, 0, frames * numOutputs * sizeof(float));
-				debug("Audio Interface IO underflow");
+				stats.underruns++;
+				stats.recordXrun();
 			}
 		}
+		callbackUsing = false;
+	}
 
-		// Notify engine when finished processing
-		engineCv.notify_one();
+	/** Reallocates the FIFOs for the stream's channels and block size, waiting until neither the engine nor the callback is using them.
+	Call from the UI thread.
+	*/
+	void resizeFifos() {
+		fifoReady = false;
+		while (engineUsing || callbackUsing) {
+			std::this_thread::yield();
+		}
+		size_t frames = std::max(AUDIO_FIFO_BLOCKS * blockSize, 1024);
+		inputBuffer.resize(frames, numInputs);
+		outputBuffer.resize(frames, numOutputs);
+		fifoBlockSize = blockSize;
+		fifoReady = true;
+	}
+
+	void onOpenStream() override {
+		// The driver may have chosen a different block size than requested
+		if (blockSize != fifoBlockSize)
+			resizeFifos();
 	}
 
 	void onCloseStream() override {
-		inputBuffer.clear();
-		outputBuffer.clear();
+		engineClockRelease(module);
+		active = false;
 	}
 
 	void onChannelsChange() override {
+		// Opening the stream sets its channels before the callback starts.
+		// Closing the stream clears them while the callback may still be running, so keep the FIFOs until the next stream.
+		if (numInputs > 0 || numOutputs > 0)
+			resizeFifos();
 	}
 };
 
 
+/** Has PORT_CHANNELS inputs and outputs, of which the device uses up to `audioIO.maxChannels`.
+There is a light for each pair of inputs, followed by a light for each pair of outputs.
+The converters and their buffers are sized for PORT_CHANNELS, so the Audio module doesn't carry the frames of Audio-64.
+Each port is monophonic, so the engine allocates a single block for each of Audio-64's 128 ports.
+*/
+template <int PORT_CHANNELS>
 struct AudioInterface : Module {
-	enum ParamIds {
-		NUM_PARAMS
-	};
 	enum InputIds {
-		ENUMS(AUDIO_INPUT, AUDIO_INPUTS),
-		NUM_INPUTS
+		AUDIO_INPUT
 	};
 	enum OutputIds {
-		ENUMS(AUDIO_OUTPUT, AUDIO_OUTPUTS),
-		NUM_OUTPUTS
+		AUDIO_OUTPUT
 	};
 	enum LightIds {
-		ENUMS(INPUT_LIGHT, AUDIO_INPUTS / 2),
-		ENUMS(OUTPUT_LIGHT, AUDIO_OUTPUTS / 2),
-		NUM_LIGHTS
+		INPUT_LIGHT
 	};
 
 	AudioInterfaceIO audioIO;
-	int lastSampleRate = 0;
-	int lastNumOutputs = -1;
-	int lastNumInputs = -1;
 
-	SampleRateConverter<AUDIO_INPUTS> inputSrc;
-	SampleRateConverter<AUDIO_OUTPUTS> outputSrc;
+	SampleRateConverter<PORT_CHANNELS> inputSrc;
+	SampleRateConverter<PORT_CHANNELS> outputSrc;
 
 	// in rack's sample rate
-	DoubleRingBuffer<Frame<AUDIO_INPUTS>, 16> inputBuffer;
-	DoubleRingBuffer<Frame<AUDIO_OUTPUTS>, 16> outputBuffer;
-
-	AudioInterface() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+	DoubleRingBuffer<Frame<PORT_CHANNELS>, 16> inputBuffer;
+	DoubleRingBuffer<Frame<PORT_CHANNELS>, 16> outputBuffer;
+
+	/** Whether to follow the drift between the device's clock and the engine's while another device steps the engine */
+	bool adaptive = true;
+	DriftController inputDrift;
+	DriftController outputDrift;
+	/** The SRC ratios are corrected every this many frames */
+	static const int driftDivision = 1024;
+	int driftCounter = 0;
+
+	AudioInterface() : Module(0, PORT_CHANNELS, PORT_CHANNELS, PORT_CHANNELS) {
+		audioIO.module = this;
+		audioIO.maxChannels = PORT_CHANNELS;
 		onSampleRateChange();
 	}
 
+	/** Reopens the device with up to `maxChannels` channels in each direction, starting at a multiple of them */
+	void setMaxChannels(int maxChannels) {
+		maxChannels = clamp(maxChannels, 1, PORT_CHANNELS);
+		if (maxChannels == audioIO.maxChannels)
+			return;
+		audioIO.maxChannels = maxChannels;
+		audioIO.setDevice(audioIO.device, audioIO.offset / maxChannels * maxChannels);
+	}
+
 	void step() override;
+	/** Exchanges a frame with the device through the FIFOs, while another device or the engine thread steps the engine */
+	void stepFifos();
+	void stepLights(bool active);
+	/** Estimates the round trip latency and publishes the SRC ratios to the stream's stats */
+	void recordStats(int numInputs, int numOutputs);
+	/** Records the device inputs of this frame while recording engine input */
+	void recordInputs();
 
 	json_t *toJson() override {
 		json_t *rootJ = json_object();
 		json_object_set_new(rootJ, "audio", audioIO.toJson());
+		json_object_set_new(rootJ, "adaptive", json_boolean(adaptive));
 		return rootJ;
 	}
 
 	void fromJson(json_t *rootJ) override {
 		json_t *audioJ = json_object_get(rootJ, "audio");
 		audioIO.fromJson(audioJ);
+		// Reopen the device if the patch has more channels than ports
+		int maxChannels = clamp(audioIO.maxChannels, 1, PORT_CHANNELS);
+		if (maxChannels != audioIO.maxChannels) {
+			audioIO.maxChannels = maxChannels;
+			audioIO.setDevice(audioIO.device, audioIO.offset / maxChannels * maxChannels);
+		}
+		json_t *adaptiveJ = json_object_get(rootJ, "adaptive");
+		if (adaptiveJ)
+			adaptive = json_boolean_value(adaptiveJ);
 	}
 
 	void onReset() override {
@@ -142,103 +320,253 @@ struct AudioInterface : Module {
 };
 
 
-void AudioInterface::step() {
+template <int PORT_CHANNELS>
+void AudioInterface<PORT_CHANNELS>::step() {
+	if (recorderIsReplaying()) {
+		// A replay has no device, so play back the recorded device inputs
+		float voltages[PORT_CHANNELS];
+		int channels = recorderReplayAudioInput(voltages, PORT_CHANNELS);
+		for (int i = 0; i < PORT_CHANNELS; i++) {
+			outputs[AUDIO_OUTPUT + i].value = (i < channels) ? voltages[i] : 0.f;
+		}
+		return;
+	}
+
+	if (audioIO.clockFrame < audioIO.clockFrames) {
+		// This device is stepping the engine, so exchange frames with its callback buffers directly
+		int frame = audioIO.clockFrame++;
+		for (int i = 0; i < audioIO.numInputs; i++) {
+			outputs[AUDIO_OUTPUT + i].value = 10.f * audioIO.clockInput[audioIO.numInputs * frame + i];
+		}
+		for (int i = audioIO.numInputs; i < PORT_CHANNELS; i++) {
+			outputs[AUDIO_OUTPUT + i].value = 0.f;
+		}
+		recordInputs();
+		for (int i = 0; i < audioIO.numOutputs; i++) {
+			audioIO.clockOutput[audioIO.numOutputs * frame + i] = clamp(inputs[AUDIO_INPUT + i].value / 10.f, -1.f, 1.f);
+		}
+		stepLights(true);
+		return;
+	}
+
+	// Keep the UI thread from reallocating the FIFOs while they are in use
+	audioIO.engineUsing = true;
+	// A patch may open the device with more channels than ports until fromJson() reopens it, which the converters have no room for
+	if (audioIO.fifoReady && audioIO.inputBuffer.stride() <= PORT_CHANNELS && audioIO.outputBuffer.stride() <= PORT_CHANNELS) {
+		stepFifos();
+	}
+	else {
+		for (int i = 0; i < PORT_CHANNELS; i++) {
+			outputs[AUDIO_OUTPUT + i].value = 0.f;
+		}
+		recordInputs();
+		stepLights(false);
+	}
+	audioIO.engineUsing = false;
+}
+
+template <int PORT_CHANNELS>
+void AudioInterface<PORT_CHANNELS>::stepFifos() {
+	// If another device steps the engine, don't make it wait on this one
+	bool blocking = !engineGetClockModule();
+	// The FIFOs are interleaved with the channels of the stream they were sized for
+	int numInputs = audioIO.inputBuffer.stride();
+	int numOutputs = audioIO.outputBuffer.stride();
+
 	// Update SRC states
 	int sampleRate = (int) engineGetSampleRate();
 	inputSrc.setRates(audioIO.sampleRate, sampleRate);
 	outputSrc.setRates(sampleRate, audioIO.sampleRate);
 
-	inputSrc.setChannels(audioIO.numInputs);
-	outputSrc.setChannels(audioIO.numOutputs);
+	inputSrc.setChannels(numInputs);
+	outputSrc.setChannels(numOutputs);
+
+	// While another device steps the engine, nothing keeps this device in time with it.
+	// Fine-tune the SRC ratios to hold the FIFOs at a block of margin beyond the block the callback exchanges.
+	bool adapting = adaptive && !blocking && audioIO.active;
+	if (adapting) {
+		int target = 2 * audioIO.blockSize;
+		float deltaTime = engineGetSampleTime();
+		if (numInputs > 0)
+			inputDrift.process(audioIO.inputBuffer.size(), target, audioIO.sampleRate, deltaTime);
+		if (numOutputs > 0)
+			outputDrift.process(audioIO.outputBuffer.size(), target, audioIO.sampleRate, deltaTime);
+		if (++driftCounter >= driftDivision) {
+			driftCounter = 0;
+			inputSrc.setRateCorrection(inputDrift.correction);
+			outputSrc.setRateCorrection(outputDrift.correction);
+		}
+	}
+	else if (inputDrift.started || outputDrift.started) {
+		inputDrift.reset();
+		outputDrift.reset();
+		inputSrc.setRateCorrection(1.0);
+		outputSrc.setRateCorrection(1.0);
+	}
 
 	// Inputs: audio engine -> rack engine
-	if (audioIO.active && audioIO.numInputs > 0) {
+	if (!audioIO.active) {
+		// Discard input left over from before the stream went idle
+		audioIO.inputBuffer.clear();
+	}
+	else if (numInputs > 0) {
 		// Wait until inputs are present
 		// Give up after a timeout in case the audio device is being unresponsive.
-		std::unique_lock<std::mutex> lock(audioIO.engineMutex);
 		auto cond = [&] {
 			return (!audioIO.inputBuffer.empty());
 		};
 		auto timeout = std::chrono::milliseconds(200);
-		if (audioIO.engineCv.wait_for(lock, timeout, cond)) {
-			// Convert inputs
-			int inLen = audioIO.inputBuffer.size();
-			int outLen = inputBuffer.capacity();
-			inputSrc.process(audioIO.inputBuffer.startData(), &inLen, inputBuffer.endData(), &outLen);
-			audioIO.inputBuffer.startIncr(inLen);
-			inputBuffer.endIncr(outLen);
+		if (blocking ? waitFor(cond, timeout) : cond()) {
+			// Convert inputs, in two parts if they wrap around the end of the FIFO
+			for (int part = 0; part < 2; part++) {
+				int inLen = audioIO.inputBuffer.startSize();
+				int outLen = inputBuffer.capacity();
+				if (inLen == 0 || outLen == 0)
+					break;
+				inputSrc.process(audioIO.inputBuffer.startData(), numInputs, &inLen, inputBuffer.endData()->samples, PORT_CHANNELS, &outLen);
+				audioIO.inputBuffer.startIncr(inLen);
+				inputBuffer.endIncr(outLen);
+			}
 		}
-		else {
+		else if (blocking) {
 			// Give up on pulling input
 			audioIO.active = false;
+			audioIO.stats.timeouts++;
+			audioIO.stats.recordXrun();
 			debug("Audio Interface underflow");
 		}
 	}
 
 	// Take input from buffer
-	Frame<AUDIO_INPUTS> inputFrame;
+	int inputChannels = 0;
 	if (!inputBuffer.empty()) {
-		inputFrame = inputBuffer.shift();
-	}
-	else {
-		memset(&inputFrame, 0, sizeof(inputFrame));
-	}
-	for (int i = 0; i < audioIO.numInputs; i++) {
-		outputs[AUDIO_OUTPUT + i].value = 10.f * inputFrame.samples[i];
+		const Frame<PORT_CHANNELS> *inputFrame = inputBuffer.startData();
+		inputChannels = std::min(numInputs, PORT_CHANNELS);
+		for (int i = 0; i < inputChannels; i++) {
+			outputs[AUDIO_OUTPUT + i].value = 10.f * inputFrame->samples[i];
+		}
+		inputBuffer.startIncr(1);
 	}
-	for (int i = audioIO.numInputs; i < AUDIO_INPUTS; i++) {
+	for (int i = inputChannels; i < PORT_CHANNELS; i++) {
 		outputs[AUDIO_OUTPUT + i].value = 0.f;
 	}
+	recordInputs();
 
 	// Outputs: rack engine -> audio engine
-	if (audioIO.active && audioIO.numOutputs > 0) {
+	if (audioIO.active && numOutputs > 0) {
 		// Get and push output SRC frame
 		if (!outputBuffer.full()) {
-			Frame<AUDIO_OUTPUTS> outputFrame;
-			for (int i = 0; i < AUDIO_OUTPUTS; i++) {
-				outputFrame.samples[i] = inputs[AUDIO_INPUT + i].value / 10.f;
+			Frame<PORT_CHANNELS> *outputFrame = outputBuffer.endData();
+			for (int i = 0; i < numOutputs; i++) {
+				outputFrame->samples[i] = (i < PORT_CHANNELS) ? inputs[AUDIO_INPUT + i].value / 10.f : 0.f;
 			}
-			outputBuffer.push(outputFrame);
+			outputBuffer.endIncr(1);
 		}
 
 		if (outputBuffer.full()) {
 			// Wait until enough outputs are consumed
 			// Give up after a timeout in case the audio device is being unresponsive.
-			std::unique_lock<std::mutex> lock(audioIO.engineMutex);
+			// While adapting, the drift controller holds the FIFO's fill level instead
 			auto cond = [&] {
-				return (audioIO.outputBuffer.size() < (size_t) audioIO.blockSize);
+				return adapting || (audioIO.outputBuffer.size() < (size_t) audioIO.blockSize);
 			};
 			auto timeout = std::chrono::milliseconds(200);
-			if (audioIO.engineCv.wait_for(lock, timeout, cond)) {
-				// Push converted output
-				int inLen = outputBuffer.size();
-				int outLen = audioIO.outputBuffer.capacity();
-				outputSrc.process(outputBuffer.startData(), &inLen, audioIO.outputBuffer.endData(), &outLen);
-				outputBuffer.startIncr(inLen);
-				audioIO.outputBuffer.endIncr(outLen);
+			if (blocking ? waitFor(cond, timeout) : cond()) {
+				// Push converted output, in two parts if it wraps around the end of the FIFO
+				for (int part = 0; part < 2; part++) {
+					int inLen = outputBuffer.size();
+					int outLen = audioIO.outputBuffer.endCapacity();
+					if (inLen == 0 || outLen == 0)
+						break;
+					outputSrc.process(outputBuffer.startData()->samples, PORT_CHANNELS, &inLen, audioIO.outputBuffer.endData(), numOutputs, &outLen);
+					outputBuffer.startIncr(inLen);
+					audioIO.outputBuffer.endIncr(outLen);
+				}
 			}
-			else {
+			else if (blocking) {
 				// Give up on pushing output
 				audioIO.active = false;
+				audioIO.inputBuffer.clear();
 				outputBuffer.clear();
+				audioIO.stats.timeouts++;
+				audioIO.stats.recordXrun();
 				debug("Audio Interface underflow");
 			}
 		}
+	}
+
+	recordStats(numInputs, numOutputs);
+	stepLights(audioIO.active);
+}
 
-		// Notify audio thread that an output is potentially ready
-		audioIO.audioCv.notify_one();
+template <int PORT_CHANNELS>
+void AudioInterface<PORT_CHANNELS>::recordStats(int numInputs, int numOutputs) {
+	// Sum the frames buffered on the way from the device's input to its output, converting engine frames to device frames
+	double deviceFrames = (double) audioIO.sampleRate / engineGetSampleRate();
+	double latency = 0.0;
+	if (audioIO.active && numInputs > 0 && numOutputs > 0) {
+		// The blocks the device buffers on each side of the callback
+		latency += 2 * audioIO.blockSize;
+		latency += audioIO.inputBuffer.size() + inputSrc.getDelay();
+		latency += (inputBuffer.size() + outputBuffer.size() + outputSrc.getDelay()) * deviceFrames;
+		latency += audioIO.outputBuffer.size();
 	}
+	// Only the UI reads these, so they needn't be ordered with anything
+	audioIO.stats.latency.store((int) latency, std::memory_order_relaxed);
+	audioIO.stats.inputRatio.store(inputSrc.getRatio(), std::memory_order_relaxed);
+	audioIO.stats.outputRatio.store(outputSrc.getRatio(), std::memory_order_relaxed);
+}
 
+template <int PORT_CHANNELS>
+void AudioInterface<PORT_CHANNELS>::recordInputs() {
+	if (!recorderIsRecording() || audioIO.numInputs <= 0)
+		return;
+	float voltages[PORT_CHANNELS];
+	int channels = std::min(audioIO.numInputs, PORT_CHANNELS);
+	for (int i = 0; i < channels; i++) {
+		voltages[i] = outputs[AUDIO_OUTPUT + i].value;
+	}
+	recorderAudioInput(voltages, channels);
+}
+
+template <int PORT_CHANNELS>
+void AudioInterface<PORT_CHANNELS>::stepLights(bool active) {
 	// Turn on light if at least one port is enabled in the nearby pair
-	for (int i = 0; i < AUDIO_INPUTS / 2; i++)
-		lights[INPUT_LIGHT + i].value = (audioIO.active && audioIO.numOutputs >= 2*i+1);
-	for (int i = 0; i < AUDIO_OUTPUTS / 2; i++)
-		lights[OUTPUT_LIGHT + i].value = (audioIO.active && audioIO.numInputs >= 2*i+1);
+	for (int i = 0; i < PORT_CHANNELS / 2; i++)
+		lights[INPUT_LIGHT + i].value = (active && audioIO.numOutputs >= 2*i+1);
+	for (int i = 0; i < PORT_CHANNELS / 2; i++)
+		lights[INPUT_LIGHT + PORT_CHANNELS / 2 + i].value = (active && audioIO.numInputs >= 2*i+1);
 }
 
 
+typedef AudioInterface<AUDIO_CHANNELS> AudioInterface8;
+
+struct AudioInterface64 : AudioInterface<AUDIO_MAX_CHANNELS> {
+	AudioInterface64() {
+		audioIO.maxChannels = 16;
+	}
+};
+
+
+template <class TAudioInterface>
+struct AudioAdaptiveItem : MenuItem {
+	TAudioInterface *module;
+	void onAction(EventAction &e) override {
+		module->adaptive ^= true;
+	}
+};
+
+struct AudioChannelsItem : MenuItem {
+	AudioInterface64 *module;
+	int channels;
+	void onAction(EventAction &e) override {
+		module->setMaxChannels(channels);
+	}
+};
+
+
 struct AudioInterfaceWidget : ModuleWidget {
-	AudioInterfaceWidget(AudioInterface *module) : ModuleWidget(module) {
+	AudioInterfaceWidget(AudioInterface8 *module) : ModuleWidget(module) {
 		setPanel(SVG::load(assetGlobal("res/Core/AudioInterface.svg")));
 
 		addChild(Widget::create<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
@@ -246,39 +574,183 @@ struct AudioInterfaceWidget : ModuleWidget {
 		addChild(Widget::create<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 		addChild(Widget::create<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 
-		addInput(Port::create<PJ301MPort>(mm2px(Vec(3.7069211, 55.530807)), Port::INPUT, module, AudioInterface::AUDIO_INPUT + 0));
-		addInput(Port::create<PJ301MPort>(mm2px(Vec(15.307249, 55.530807)), Port::INPUT, module, AudioInterface::AUDIO_INPUT + 1));
-		addInput(Port::create<PJ301MPort>(mm2px(Vec(26.906193, 55.530807)), Port::INPUT, module, AudioInterface::AUDIO_INPUT + 2));
-		addInput(Port::create<PJ301MPort>(mm2px(Vec(38.506519, 55.530807)), Port::INPUT, module, AudioInterface::AUDIO_INPUT + 3));
-		addInput(Port::create<PJ301MPort>(mm2px(Vec(3.7069209, 70.144905)), Port::INPUT, module, AudioInterface::AUDIO_INPUT + 4));
-		addInput(Port::create<PJ301MPort>(mm2px(Vec(15.307249, 70.144905)), Port::INPUT, module, AudioInterface::AUDIO_INPUT + 5));
-		addInput(Port::create<PJ301MPort>(mm2px(Vec(26.906193, 70.144905)), Port::INPUT, module, AudioInterface::AUDIO_INPUT + 6));
-		addInput(Port::create<PJ301MPort>(mm2px(Vec(38.506519, 70.144905)), Port::INPUT, module, AudioInterface::AUDIO_INPUT + 7));
-
-		addOutput(Port::create<PJ301MPort>(mm2px(Vec(3.7069209, 92.143906)), Port::OUTPUT, module, AudioInterface::AUDIO_OUTPUT + 0));
-		addOutput(Port::create<PJ301MPort>(mm2px(Vec(15.307249, 92.143906)), Port::OUTPUT, module, AudioInterface::AUDIO_OUTPUT + 1));
-		addOutput(Port::create<PJ301MPort>(mm2px(Vec(26.906193, 92.143906)), Port::OUTPUT, module, AudioInterface::AUDIO_OUTPUT + 2));
-		addOutput(Port::create<PJ301MPort>(mm2px(Vec(38.506519, 92.143906)), Port::OUTPUT, module, AudioInterface::AUDIO_OUTPUT + 3));
-		addOutput(Port::create<PJ301MPort>(mm2px(Vec(3.7069209, 108.1443)), Port::OUTPUT, module, AudioInterface::AUDIO_OUTPUT + 4));
-		addOutput(Port::create<PJ301MPort>(mm2px(Vec(15.307249, 108.1443)), Port::OUTPUT, module, AudioInterface::AUDIO_OUTPUT + 5));
-		addOutput(Port::create<PJ301MPort>(mm2px(Vec(26.906193, 108.1443)), Port::OUTPUT, module, AudioInterface::AUDIO_OUTPUT + 6));
-		addOutput(Port::create<PJ301MPort>(mm2px(Vec(38.506523, 108.1443)), Port::OUTPUT, module, AudioInterface::AUDIO_OUTPUT + 7));
-
-		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(12.524985, 54.577202)), module, AudioInterface::INPUT_LIGHT + 0));
-		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(35.725647, 54.577202)), module, AudioInterface::INPUT_LIGHT + 1));
-		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(12.524985, 69.158226)), module, AudioInterface::INPUT_LIGHT + 2));
-		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(35.725647, 69.158226)), module, AudioInterface::INPUT_LIGHT + 3));
-		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(12.524985, 91.147583)), module, AudioInterface::OUTPUT_LIGHT + 0));
-		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(35.725647, 91.147583)), module, AudioInterface::OUTPUT_LIGHT + 1));
-		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(12.524985, 107.17003)), module, AudioInterface::OUTPUT_LIGHT + 2));
-		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(35.725647, 107.17003)), module, AudioInterface::OUTPUT_LIGHT + 3));
+		addInput(Port::create<PJ301MPort>(mm2px(Vec(3.7069211, 55.530807)), Port::INPUT, module, AudioInterface8::AUDIO_INPUT + 0));
+		addInput(Port::create<PJ301MPort>(mm2px(Vec(15.307249, 55.530807)), Port::INPUT, module, AudioInterface8::AUDIO_INPUT + 1));
+		addInput(Port::create<PJ301MPort>(mm2px(Vec(26.906193, 55.530807)), Port::INPUT, module, AudioInterface8::AUDIO_INPUT + 2));
+		addInput(Port::create<PJ301MPort>(mm2px(Vec(38.506519, 55.530807)), Port::INPUT, module, AudioInterface8::AUDIO_INPUT + 3));
+		addInput(Port::create<PJ301MPort>(mm2px(Vec(3.7069209, 70.144905)), Port::INPUT, module, AudioInterface8::AUDIO_INPUT + 4));
+		addInput(Port::create<PJ301MPort>(mm2px(Vec(15.307249, 70.144905)), Port::INPUT, module, AudioInterface8::AUDIO_INPUT + 5));
+		addInput(Port::create<PJ301MPort>(mm2px(Vec(26.906193, 70.144905)), Port::INPUT, module, AudioInterface8::AUDIO_INPUT + 6));
+		addInput(Port::create<PJ301MPort>(mm2px(Vec(38.506519, 70.144905)), Port::INPUT, module, AudioInterface8::AUDIO_INPUT + 7));
+
+		addOutput(Port::create<PJ301MPort>(mm2px(Vec(3.7069209, 92.143906)), Port::OUTPUT, module, AudioInterface8::AUDIO_OUTPUT + 0));
+		addOutput(Port::create<PJ301MPort>(mm2px(Vec(15.307249, 92.143906)), Port::OUTPUT, module, AudioInterface8::AUDIO_OUTPUT + 1));
+		addOutput(Port::create<PJ301MPort>(mm2px(Vec(26.906193, 92.143906)), Port::OUTPUT, module, AudioInterface8::AUDIO_OUTPUT + 2));
+		addOutput(Port::create<PJ301MPort>(mm2px(Vec(38.506519, 92.143906)), Port::OUTPUT, module, AudioInterface8::AUDIO_OUTPUT + 3));
+		addOutput(Port::create<PJ301MPort>(mm2px(Vec(3.7069209, 108.1443)), Port::OUTPUT, module, AudioInterface8::AUDIO_OUTPUT + 4));
+		addOutput(Port::create<PJ301MPort>(mm2px(Vec(15.307249, 108.1443)), Port::OUTPUT, module, AudioInterface8::AUDIO_OUTPUT + 5));
+		addOutput(Port::create<PJ301MPort>(mm2px(Vec(26.906193, 108.1443)), Port::OUTPUT, module, AudioInterface8::AUDIO_OUTPUT + 6));
+		addOutput(Port::create<PJ301MPort>(mm2px(Vec(38.506523, 108.1443)), Port::OUTPUT, module, AudioInterface8::AUDIO_OUTPUT + 7));
+
+		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(12.524985, 54.577202)), module, AudioInterface8::INPUT_LIGHT + 0));
+		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(35.725647, 54.577202)), module, AudioInterface8::INPUT_LIGHT + 1));
+		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(12.524985, 69.158226)), module, AudioInterface8::INPUT_LIGHT + 2));
+		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(35.725647, 69.158226)), module, AudioInterface8::INPUT_LIGHT + 3));
+		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(12.524985, 91.147583)), module, AudioInterface8::INPUT_LIGHT + AUDIO_CHANNELS / 2 + 0));
+		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(35.725647, 91.147583)), module, AudioInterface8::INPUT_LIGHT + AUDIO_CHANNELS / 2 + 1));
+		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(12.524985, 107.17003)), module, AudioInterface8::INPUT_LIGHT + AUDIO_CHANNELS / 2 + 2));
+		addChild(ModuleLightWidget::create<SmallLight<GreenLight>>(mm2px(Vec(35.725647, 107.17003)), module, AudioInterface8::INPUT_LIGHT + AUDIO_CHANNELS / 2 + 3));
 
 		AudioWidget *audioWidget = Widget::create<AudioWidget>(mm2px(Vec(3.2122073, 14.837339)));
 		audioWidget->box.size = mm2px(Vec(44, 28));
 		audioWidget->audioIO = &module->audioIO;
 		addChild(audioWidget);
 	}
+
+	void appendContextMenu(Menu *menu) override {
+		AudioInterface8 *module = dynamic_cast<AudioInterface8*>(this->module);
+
+		menu->addChild(MenuEntry::create());
+		AudioAdaptiveItem<AudioInterface8> *adaptiveItem = MenuItem::create<AudioAdaptiveItem<AudioInterface8>>("Adaptive resampling", CHECKMARK(module->adaptive));
+		adaptiveItem->module = module;
+		menu->addChild(adaptiveItem);
+	}
+};
+
+
+/** Lays out the ports of the device's channels on a plain panel, scaling its width with the channel count */
+struct AudioInterface64Widget : ModuleWidget {
+	/** Ports per row for up to 32 channels, and for more */
+	static const int NARROW_COLUMNS = 8;
+	static const int WIDE_COLUMNS = 16;
+
+	AudioInterface64 *audioModule;
+	Panel *panel;
+	Label *inputLabel;
+	Label *outputLabel;
+	std::vector<ModuleLightWidget*> inputLights;
+	std::vector<ModuleLightWidget*> outputLights;
+	Widget *topRightScrew;
+	Widget *bottomRightScrew;
+	int layoutChannels = 0;
+
+	AudioInterface64Widget(AudioInterface64 *module) : ModuleWidget(module) {
+		audioModule = module;
+		box.size.y = RACK_GRID_HEIGHT;
+
+		panel = new LightPanel();
+		addChild(panel);
+
+		addChild(Widget::create<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+		addChild(Widget::create<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+		topRightScrew = Widget::create<ScrewSilver>(Vec(0, 0));
+		bottomRightScrew = Widget::create<ScrewSilver>(Vec(0, RACK_GRID_HEIGHT - RACK_GRID_WIDTH));
+		addChild(topRightScrew);
+		addChild(bottomRightScrew);
+
+		AudioWidget *audioWidget = Widget::create<AudioWidget>(mm2px(Vec(3.2122073, 14.837339)));
+		audioWidget->box.size = mm2px(Vec(44, 28));
+		audioWidget->audioIO = module ? &module->audioIO : NULL;
+		addChild(audioWidget);
+
+		inputLabel = Widget::create<Label>(mm2px(Vec(3.2122073, 43.0)));
+		inputLabel->text = "To device";
+		addChild(inputLabel);
+		outputLabel = Widget::create<Label>(mm2px(Vec(3.2122073, 83.0)));
+		outputLabel->text = "From device";
+		addChild(outputLabel);
+
+		// Create the ports and lights of every channel, and show those of the device's channels
+		for (int i = 0; i < AUDIO_MAX_CHANNELS; i++) {
+			addInput(Port::create<PJ301MPort>(Vec(), Port::INPUT, module, AudioInterface64::AUDIO_INPUT + i));
+		}
+		for (int i = 0; i < AUDIO_MAX_CHANNELS; i++) {
+			addOutput(Port::create<PJ301MPort>(Vec(), Port::OUTPUT, module, AudioInterface64::AUDIO_OUTPUT + i));
+		}
+		for (int i = 0; i < AUDIO_MAX_CHANNELS / 2; i++) {
+			inputLights.push_back(ModuleLightWidget::create<SmallLight<GreenLight>>(Vec(), module, AudioInterface64::INPUT_LIGHT + i));
+			addChild(inputLights.back());
+		}
+		for (int i = 0; i < AUDIO_MAX_CHANNELS / 2; i++) {
+			outputLights.push_back(ModuleLightWidget::create<SmallLight<GreenLight>>(Vec(), module, AudioInterface64::INPUT_LIGHT + AUDIO_MAX_CHANNELS / 2 + i));
+			addChild(outputLights.back());
+		}
+		layout(module ? module->audioIO.maxChannels : 16);
+	}
+
+	/** Shows the ports of `channels` channels in rows under each label, removing the wires of the ports it hides */
+	void layout(int channels) {
+		layoutChannels = channels;
+		int columns = (channels <= 4 * NARROW_COLUMNS) ? NARROW_COLUMNS : WIDE_COLUMNS;
+		const float pitchX = 11.0;
+		const float pitchY = 8.8;
+		const float marginX = 2 * RACK_GRID_WIDTH;
+
+		for (int i = 0; i < AUDIO_MAX_CHANNELS; i++) {
+			Vec pos = Vec(marginX, 0).plus(mm2px(Vec(pitchX * (i % columns), pitchY * (i / columns))));
+			bool visible = (i < channels);
+			Port *ports[2] = {inputs[i], outputs[i]};
+			for (int j = 0; j < 2; j++) {
+				ports[j]->box.pos = pos.plus(mm2px(Vec(0, (j == 0) ? 48.0 : 88.5)));
+				if (ports[j]->visible && !visible)
+					gRackWidget->wireContainer->removeAllWires(ports[j]);
+				ports[j]->visible = visible;
+			}
+			// The light of each pair is between its ports
+			if (i % 2 == 0) {
+				Vec lightPos = pos.plus(mm2px(Vec(8.4, -1.0)));
+				inputLights[i / 2]->box.pos = lightPos.plus(mm2px(Vec(0, 48.0)));
+				outputLights[i / 2]->box.pos = lightPos.plus(mm2px(Vec(0, 88.5)));
+				inputLights[i / 2]->visible = visible;
+				outputLights[i / 2]->visible = visible;
+			}
+		}
+
+		// Round the width up to the rack grid
+		float width = 2 * marginX + mm2px(pitchX * columns);
+		width = ceilf(width / RACK_GRID_WIDTH) * RACK_GRID_WIDTH;
+		if (width != box.size.x) {
+			Rect newBox = box;
+			newBox.size.x = width;
+			if (parent == gRackWidget->moduleContainer) {
+				// Move the module if it no longer fits between its neighbors
+				if (!gRackWidget->requestModuleBox(this, newBox))
+					gRackWidget->requestModuleBoxNearest(this, newBox);
+			}
+			else {
+				box = newBox;
+			}
+		}
+		panel->box.size = box.size;
+		inputLabel->box.size.x = box.size.x;
+		outputLabel->box.size.x = box.size.x;
+		topRightScrew->box.pos.x = box.size.x - 2 * RACK_GRID_WIDTH;
+		bottomRightScrew->box.pos.x = box.size.x - 2 * RACK_GRID_WIDTH;
+	}
+
+	void step() override {
+		if (audioModule && audioModule->audioIO.maxChannels != layoutChannels)
+			layout(audioModule->audioIO.maxChannels);
+		ModuleWidget::step();
+	}
+
+	void appendContextMenu(Menu *menu) override {
+		menu->addChild(MenuEntry::create());
+		AudioAdaptiveItem<AudioInterface64> *adaptiveItem = MenuItem::create<AudioAdaptiveItem<AudioInterface64>>("Adaptive resampling", CHECKMARK(audioModule->adaptive));
+		adaptiveItem->module = audioModule;
+		menu->addChild(adaptiveItem);
+
+		menu->addChild(MenuEntry::create());
+		menu->addChild(MenuLabel::create("Channels"));
+		for (int channels : {16, 32, 64}) {
+			AudioChannelsItem *item = MenuItem::create<AudioChannelsItem>(stringf("%d", channels), CHECKMARK(audioModule->audioIO.maxChannels == channels));
+			item->module = audioModule;
+			item->channels = channels;
+			menu->addChild(item);
+		}
+	}
 };
 
 
-Model *modelAudioInterface = Model::create<AudioInterface, AudioInterfaceWidget>("Core", "AudioInterface", "Audio", EXTERNAL_TAG);
\ No newline at end of file
+Model *modelAudioInterface = Model::create<AudioInterface8, AudioInterfaceWidget>("Core", "AudioInterface", "Audio", EXTERNAL_TAG);
+Model *modelAudioInterface64 = Model::create<AudioInterface64, AudioInterface64Widget>("Core", "AudioInterface64", "Audio-64", EXTERNAL_TAG);
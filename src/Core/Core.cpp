@@ -6,6 +6,7 @@ void init(rack::Plugin *p) {
 	p->version = TOSTRING(VERSION);
 
 	p->addModel(modelAudioInterface);
+	p->addModel(modelAudioInterface64);
 	p->addModel(modelMIDIToCVInterface);
 	p->addModel(modelQuadMIDIToCVInterface);
 	p->addModel(modelMIDICCToCVInterface);
@@ -5,6 +5,7 @@ using namespace rack;
 
 
 extern Model *modelAudioInterface;
+extern Model *modelAudioInterface64;
 extern Model *modelMIDIToCVInterface;
 extern Model *modelQuadMIDIToCVInterface;
 extern Model *modelMIDICCToCVInterface;
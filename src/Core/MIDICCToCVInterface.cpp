@@ -27,6 +27,9 @@ struct MIDICCToCVInterface : Module {
 	int learnedCcs[16] = {};
 
 	MIDICCToCVInterface() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+		// CCs are still learned while none of the outputs are plugged in
+		outputOnly = true;
+		midiInput.module = this;
 		onReset();
 	}
 
@@ -40,12 +43,11 @@ struct MIDICCToCVInterface : Module {
 		learningId = -1;
 	}
 
-	void step() override {
-		MidiMessage msg;
-		while (midiInput.shift(&msg)) {
-			processMessage(msg);
-		}
+	void onMidiMessage(MidiMessage msg) override {
+		processMessage(msg);
+	}
 
+	void step() override {
 		float lambda = 100.f * engineGetSampleTime();
 		for (int i = 0; i < 16; i++) {
 			int learnedCc = learnedCcs[i];
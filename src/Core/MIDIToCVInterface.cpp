@@ -58,6 +58,9 @@ struct MIDIToCVInterface : Module {
 	bool gate;
 
 	MIDIToCVInterface() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS), heldNotes(128) {
+		// MIDI messages still reach onMidiMessage() while the engine skips the module
+		outputOnly = true;
+		midiInput.module = this;
 		onReset();
 	}
 
@@ -139,11 +142,11 @@ struct MIDIToCVInterface : Module {
 		releaseNote(255);
 	}
 
+	void onMidiMessage(MidiMessage msg) override {
+		processMessage(msg);
+	}
+
 	void step() override {
-		MidiMessage msg;
-		while (midiInput.shift(&msg)) {
-			processMessage(msg);
-		}
 		float deltaTime = engineGetSampleTime();
 
 		outputs[CV_OUTPUT].value = (lastNote - 60) / 12.f;
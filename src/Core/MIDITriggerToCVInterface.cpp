@@ -27,6 +27,9 @@ struct MIDITriggerToCVInterface : Module {
 	bool velocity = false;
 
 	MIDITriggerToCVInterface() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+		// Notes are still learned while none of the outputs are plugged in
+		outputOnly = true;
+		midiInput.module = this;
 		onReset();
 	}
 
@@ -64,11 +67,11 @@ struct MIDITriggerToCVInterface : Module {
 		}
 	}
 
+	void onMidiMessage(MidiMessage msg) override {
+		processMessage(msg);
+	}
+
 	void step() override {
-		MidiMessage msg;
-		while (midiInput.shift(&msg)) {
-			processMessage(msg);
-		}
 		float deltaTime = engineGetSampleTime();
 
 		for (int i = 0; i < 16; i++) {
@@ -52,6 +52,14 @@ struct QuadMIDIToCVInterface : Module {
 	int stealIndex;
 
 	QuadMIDIToCVInterface() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS), cachedNotes(128) {
+		// The first row also carries every voice on one polyphonic cable, which monophonic inputs read as the first voice
+		outputs[CV_OUTPUT + 0].maxChannels = 4;
+		outputs[GATE_OUTPUT + 0].maxChannels = 4;
+		outputs[VELOCITY_OUTPUT + 0].maxChannels = 4;
+		outputs[AFTERTOUCH_OUTPUT + 0].maxChannels = 4;
+		// Notes are still assigned to voices while none of the outputs are plugged in
+		outputOnly = true;
+		midiInput.module = this;
 		onReset();
 	}
 
@@ -240,19 +248,30 @@ struct QuadMIDIToCVInterface : Module {
 		}
 	}
 
-	void step() override {
-		MidiMessage msg;
-		while (midiInput.shift(&msg)) {
-			processMessage(msg);
-		}
+	void onMidiMessage(MidiMessage msg) override {
+		processMessage(msg);
+	}
 
+	void step() override {
+		outputs[CV_OUTPUT + 0].setChannels(4);
+		outputs[GATE_OUTPUT + 0].setChannels(4);
+		outputs[VELOCITY_OUTPUT + 0].setChannels(4);
+		outputs[AFTERTOUCH_OUTPUT + 0].setChannels(4);
 		for (int i = 0; i < 4; i++) {
 			uint8_t lastNote = notes[i];
 			uint8_t lastGate = (gates[i] || pedalgates[i]);
-			outputs[CV_OUTPUT + i].value = (lastNote - 60) / 12.f;
-			outputs[GATE_OUTPUT + i].value = lastGate ? 10.f : 0.f;
-			outputs[VELOCITY_OUTPUT + i].value = rescale(noteData[lastNote].velocity, 0, 127, 0.f, 10.f);
-			outputs[AFTERTOUCH_OUTPUT + i].value = rescale(noteData[lastNote].aftertouch, 0, 127, 0.f, 10.f);
+			float cv = (lastNote - 60) / 12.f;
+			float gate = lastGate ? 10.f : 0.f;
+			float velocity = rescale(noteData[lastNote].velocity, 0, 127, 0.f, 10.f);
+			float aftertouch = rescale(noteData[lastNote].aftertouch, 0, 127, 0.f, 10.f);
+			outputs[CV_OUTPUT + i].value = cv;
+			outputs[GATE_OUTPUT + i].value = gate;
+			outputs[VELOCITY_OUTPUT + i].value = velocity;
+			outputs[AFTERTOUCH_OUTPUT + i].value = aftertouch;
+			outputs[CV_OUTPUT + 0].setVoltage(cv, i);
+			outputs[GATE_OUTPUT + 0].setVoltage(gate, i);
+			outputs[VELOCITY_OUTPUT + 0].setVoltage(velocity, i);
+			outputs[AFTERTOUCH_OUTPUT + 0].setVoltage(aftertouch, i);
 		}
 	}
 
@@ -1,5 +1,6 @@
 ﻿#include "app.hpp"
 #include "audio.hpp"
+#include "window.hpp"
 
 
 namespace rack {
@@ -150,6 +151,77 @@ struct AudioBlockSizeChoice : LedDisplayChoice {
 };
 
 
+struct AudioStatsResetItem : MenuItem {
+	AudioIO *audioIO;
+	void onAction(EventAction &e) override {
+		audioIO->stats.resetRequested = true;
+	}
+};
+
+struct AudioStatsCopyItem : MenuItem {
+	AudioIO *audioIO;
+	void onAction(EventAction &e) override {
+		json_t *statsJ = audioIO->statsToJson();
+		char *statsJson = json_dumps(statsJ, JSON_INDENT(2) | JSON_REAL_PRECISION(9));
+		glfwSetClipboardString(gWindow, statsJson);
+		free(statsJson);
+		json_decref(statsJ);
+	}
+};
+
+struct AudioStatsChoice : LedDisplayChoice {
+	AudioWidget *audioWidget;
+	void onAction(EventAction &e) override {
+		AudioIO *audioIO = audioWidget->audioIO;
+		const AudioStats &stats = audioIO->stats;
+		double msPerCycle = 1000.0 / profilerCyclesPerSecond();
+		double msPerFrame = 1000.0 / audioIO->sampleRate;
+		Menu *menu = gScene->createMenu();
+		menu->addChild(construct<MenuLabel>(&MenuLabel::text, "Audio statistics"));
+		menu->addChild(construct<MenuLabel>(&MenuLabel::text, stringf("Device xruns: %d", (int) stats.deviceXruns)));
+		menu->addChild(construct<MenuLabel>(&MenuLabel::text, stringf("Underruns: %d, overruns: %d", (int) stats.underruns, (int) stats.overruns)));
+		menu->addChild(construct<MenuLabel>(&MenuLabel::text, stringf("Timeouts: %d", (int) stats.timeouts)));
+		int64_t lastXrun = stats.lastXrunFrame;
+		if (lastXrun >= 0)
+			menu->addChild(construct<MenuLabel>(&MenuLabel::text, stringf("Last xrun: %.1f s after start", lastXrun * msPerFrame / 1000.0)));
+		menu->addChild(construct<MenuLabel>(&MenuLabel::text, stringf("Input FIFO fill p1 %d, p50 %d frames", (int) stats.inputFill.percentile(0.01f), (int) stats.inputFill.percentile(0.5f))));
+		menu->addChild(construct<MenuLabel>(&MenuLabel::text, stringf("Output FIFO fill p1 %d, p50 %d frames", (int) stats.outputFill.percentile(0.01f), (int) stats.outputFill.percentile(0.5f))));
+		menu->addChild(construct<MenuLabel>(&MenuLabel::text, stringf("Callback interval p50 %.2f ms, jitter p99 %.2f ms", stats.callbackInterval.percentile(0.5f) * msPerCycle, stats.callbackJitter.percentile(0.99f) * msPerCycle)));
+		menu->addChild(construct<MenuLabel>(&MenuLabel::text, stringf("Round trip: %d frames (%.1f ms)", (int) stats.latency, stats.latency * msPerFrame)));
+		menu->addChild(construct<MenuLabel>(&MenuLabel::text, stringf("SRC ratio in %.6f, out %.6f", (double) stats.inputRatio, (double) stats.outputRatio)));
+
+		AudioStatsResetItem *resetItem = new AudioStatsResetItem();
+		resetItem->audioIO = audioIO;
+		resetItem->text = "Reset statistics";
+		menu->addChild(resetItem);
+
+		AudioStatsCopyItem *copyItem = new AudioStatsCopyItem();
+		copyItem->audioIO = audioIO;
+		copyItem->text = "Copy statistics as JSON";
+		menu->addChild(copyItem);
+	}
+	void step() override {
+		AudioIO *audioIO = audioWidget->audioIO;
+		if (audioIO->numInputs == 0 && audioIO->numOutputs == 0) {
+			text = "No stream";
+			color.a = 0.5f;
+			return;
+		}
+		color.a = 1.f;
+		text = stringf("%d xruns", audioIO->stats.getXruns());
+		int latency = audioIO->stats.latency;
+		if (latency > 0)
+			text += stringf(", %.1f ms", latency * 1000.f / audioIO->sampleRate);
+	}
+};
+
+
+/** The stats add a fourth row to the display, so its rows are shorter than the default of LedDisplayChoice */
+static void setRowHeight(LedDisplayChoice *choice) {
+	choice->box.size.y = mm2px(28.0 / 4);
+	choice->textOffset.y = 14;
+}
+
 AudioWidget::AudioWidget() {
 	box.size = mm2px(Vec(44, 28));
 
@@ -157,6 +229,7 @@ AudioWidget::AudioWidget() {
 
 	AudioDriverChoice *driverChoice = Widget::create<AudioDriverChoice>(pos);
 	driverChoice->audioWidget = this;
+	setRowHeight(driverChoice);
 	addChild(driverChoice);
 	pos = driverChoice->box.getBottomLeft();
 	this->driverChoice = driverChoice;
@@ -166,6 +239,7 @@ AudioWidget::AudioWidget() {
 
 	AudioDeviceChoice *deviceChoice = Widget::create<AudioDeviceChoice>(pos);
 	deviceChoice->audioWidget = this;
+	setRowHeight(deviceChoice);
 	addChild(deviceChoice);
 	pos = deviceChoice->box.getBottomLeft();
 	this->deviceChoice = deviceChoice;
@@ -175,6 +249,7 @@ AudioWidget::AudioWidget() {
 
 	AudioSampleRateChoice *sampleRateChoice = Widget::create<AudioSampleRateChoice>(pos);
 	sampleRateChoice->audioWidget = this;
+	setRowHeight(sampleRateChoice);
 	addChild(sampleRateChoice);
 	this->sampleRateChoice = sampleRateChoice;
 
@@ -184,8 +259,19 @@ AudioWidget::AudioWidget() {
 
 	AudioBlockSizeChoice *bufferSizeChoice = Widget::create<AudioBlockSizeChoice>(pos);
 	bufferSizeChoice->audioWidget = this;
+	setRowHeight(bufferSizeChoice);
 	addChild(bufferSizeChoice);
+	pos = bufferSizeChoice->box.getBottomLeft();
 	this->bufferSizeChoice = bufferSizeChoice;
+
+	this->bufferSizeSeparator = Widget::create<LedDisplaySeparator>(pos);
+	addChild(this->bufferSizeSeparator);
+
+	AudioStatsChoice *statsChoice = Widget::create<AudioStatsChoice>(pos);
+	statsChoice->audioWidget = this;
+	setRowHeight(statsChoice);
+	addChild(statsChoice);
+	this->statsChoice = statsChoice;
 }
 
 void AudioWidget::step() {
@@ -197,6 +283,8 @@ void AudioWidget::step() {
 	this->sampleRateSeparator->box.pos.x = box.size.x / 2;
 	this->bufferSizeChoice->box.pos.x = box.size.x / 2;
 	this->bufferSizeChoice->box.size.x = box.size.x / 2;
+	this->bufferSizeSeparator->box.size.x = box.size.x;
+	this->statsChoice->box.size.x = box.size.x;
 	LedDisplay::step();
 }
 
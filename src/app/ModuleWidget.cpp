@@ -77,6 +77,12 @@ json_t *ModuleWidget::toJson() {
 		json_array_append_new(paramsJ, paramJ);
 	}
 	json_object_set_new(rootJ, "params", paramsJ);
+	// bypass
+	if (module && module->bypassed)
+		json_object_set_new(rootJ, "bypass", json_true());
+	// oversample
+	if (module && module->oversample > 1)
+		json_object_set_new(rootJ, "oversample", json_integer(module->oversample));
 	// data
 	if (module) {
 		json_t *dataJ = module->toJson();
@@ -155,6 +161,18 @@ void ModuleWidget::fromJson(json_t *rootJ) {
 		}
 	}
 
+	// bypass
+	if (module) {
+		json_t *bypassJ = json_object_get(rootJ, "bypass");
+		engineSetModuleBypass(module, json_is_true(bypassJ));
+	}
+
+	// oversample
+	if (module) {
+		json_t *oversampleJ = json_object_get(rootJ, "oversample");
+		engineSetModuleOversample(module, oversampleJ ? json_integer_value(oversampleJ) : 1);
+	}
+
 	// data
 	json_t *dataJ = json_object_get(rootJ, "data");
 	if (dataJ && module) {
@@ -295,20 +313,32 @@ void ModuleWidget::draw(NVGcontext *vg) {
 	nvgScissor(vg, 0, 0, box.size.x, box.size.y);
 	Widget::draw(vg);
 
+	// Dim bypassed modules
+	if (module && module->bypassed) {
+		nvgBeginPath(vg);
+		nvgRect(vg, 0, 0, box.size.x, box.size.y);
+		nvgFillColor(vg, nvgRGBAf(0, 0, 0, 0.4));
+		nvgFill(vg);
+	}
+
 	// Power meter
 	if (module && gPowerMeter) {
 		nvgBeginPath(vg);
 		nvgRect(vg,
-			0, box.size.y - 20,
-			55, 20);
+			0, box.size.y - 35,
+			55, 35);
 		nvgFillColor(vg, nvgRGBAf(0, 0, 0, 0.5));
 		nvgFill(vg);
 
+		// 99th percentile of the sampled step times, in the same units as the smoothed CPU time
+		float p99 = module->profile.percentile(0.99f) / profilerCyclesPerSecond() * engineGetSampleRate();
 		std::string cpuText = stringf("%.0f mS", module->cpuTime * 1000.f);
+		std::string p99Text = stringf("p99 %.0f", p99 * 1000.f);
 		nvgFontFaceId(vg, gGuiFont->handle);
 		nvgFontSize(vg, 12);
 		nvgFillColor(vg, nvgRGBf(1, 1, 1));
-		nvgText(vg, 10.0, box.size.y - 6.0, cpuText.c_str(), NULL);
+		nvgText(vg, 10.0, box.size.y - 21.0, cpuText.c_str(), NULL);
+		nvgText(vg, 10.0, box.size.y - 6.0, p99Text.c_str(), NULL);
 
 		float p = clamp(module->cpuTime, 0.f, 1.f);
 		nvgBeginPath(vg);
@@ -408,6 +438,14 @@ void ModuleWidget::onHoverKey(EventHoverKey &e) {
 				return;
 			}
 		} break;
+		case GLFW_KEY_E: {
+			if (windowIsModPressed() && !windowIsShiftPressed()) {
+				if (module)
+					engineSetModuleBypass(module, !module->bypassed);
+				e.consumed = true;
+				return;
+			}
+		} break;
 	}
 
 	Widget::onHoverKey(e);
@@ -450,6 +488,36 @@ struct ModuleRandomizeItem : MenuItem {
 	}
 };
 
+struct ModuleBypassItem : MenuItem {
+	ModuleWidget *moduleWidget;
+	void onAction(EventAction &e) override {
+		Module *module = moduleWidget->module;
+		engineSetModuleBypass(module, !module->bypassed);
+	}
+};
+
+struct ModuleOversampleValueItem : MenuItem {
+	Module *module;
+	int oversample;
+	void onAction(EventAction &e) override {
+		engineSetModuleOversample(module, oversample);
+	}
+};
+
+struct ModuleOversampleItem : MenuItem {
+	Module *module;
+	Menu *createChildMenu() override {
+		Menu *menu = new Menu();
+		for (int oversample = 1; oversample <= MODULE_MAX_OVERSAMPLE; oversample *= 2) {
+			ModuleOversampleValueItem *item = MenuItem::create<ModuleOversampleValueItem>((oversample == 1) ? "Off" : stringf("%dx", oversample), CHECKMARK(module->oversample == oversample));
+			item->module = module;
+			item->oversample = oversample;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
 struct ModuleCopyItem : MenuItem {
 	ModuleWidget *moduleWidget;
 	void onAction(EventAction &e) override {
@@ -519,6 +587,20 @@ Menu *ModuleWidget::createContextMenu() {
 	disconnectItem->moduleWidget = this;
 	menu->addChild(disconnectItem);
 
+	if (module) {
+		ModuleBypassItem *bypassItem = new ModuleBypassItem();
+		bypassItem->text = "Bypass";
+		bypassItem->rightText = std::string(WINDOW_MOD_KEY_NAME "+E ") + CHECKMARK(module->bypassed);
+		bypassItem->moduleWidget = this;
+		menu->addChild(bypassItem);
+
+		ModuleOversampleItem *oversampleItem = new ModuleOversampleItem();
+		oversampleItem->text = "Oversample";
+		oversampleItem->rightText = (module->oversample > 1) ? stringf("%dx", module->oversample) : "";
+		oversampleItem->module = module;
+		menu->addChild(oversampleItem);
+	}
+
 	ModuleCloneItem *cloneItem = new ModuleCloneItem();
 	cloneItem->text = "Duplicate";
 	cloneItem->rightText = WINDOW_MOD_KEY_NAME "+D";
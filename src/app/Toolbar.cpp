@@ -2,6 +2,7 @@
 #include "window.hpp"
 #include "engine.hpp"
 #include "asset.hpp"
+#include "recorder.hpp"
 
 
 namespace rack {
@@ -113,6 +114,41 @@ struct SampleRateItem : MenuItem {
 	}
 };
 
+struct ThreadCountItem : MenuItem {
+	int threadCount;
+	void onAction(EventAction &e) override {
+		engineSetThreadCount(threadCount);
+	}
+};
+
+struct BlockSizeItem : MenuItem {
+	int blockSize;
+	void onAction(EventAction &e) override {
+		engineSetBlockSize(blockSize);
+	}
+};
+
+struct ProfileSaveItem : MenuItem {
+	void onAction(EventAction &e) override {
+		profilerSave(assetLocal("profile.json"));
+	}
+};
+
+struct ProfileResetItem : MenuItem {
+	void onAction(EventAction &e) override {
+		engineResetProfile();
+	}
+};
+
+struct RecordItem : MenuItem {
+	void onAction(EventAction &e) override {
+		if (recorderIsRecording())
+			recorderStop();
+		else
+			recorderStart(assetLocal("recording.rec"));
+	}
+};
+
 struct SampleRateButton : TooltipIconButton {
 	SampleRateButton() {
 		setSVG(SVG::load(assetGlobal("res/icons/noun_1240789_cc.svg")));
@@ -137,6 +173,57 @@ struct SampleRateButton : TooltipIconButton {
 			item->sampleRate = sampleRate;
 			menu->addChild(item);
 		}
+
+		menu->addChild(MenuLabel::create("Engine threads"));
+
+		for (int threadCount = 1; threadCount <= engineGetMaxThreadCount(); threadCount *= 2) {
+			ThreadCountItem *item = new ThreadCountItem();
+			item->text = (threadCount == 1) ? "1 thread" : stringf("%d threads", threadCount);
+			item->rightText = CHECKMARK(engineGetThreadCount() == threadCount);
+			item->threadCount = threadCount;
+			menu->addChild(item);
+		}
+
+		menu->addChild(MenuLabel::create("Engine block size"));
+
+		std::vector<int> blockSizes = {1, 16, 32, 64, 128, 256};
+		for (int blockSize : blockSizes) {
+			BlockSizeItem *item = new BlockSizeItem();
+			item->text = (blockSize == 1) ? "1 frame" : stringf("%d frames", blockSize);
+			item->rightText = CHECKMARK(engineGetBlockSize() == blockSize);
+			item->blockSize = blockSize;
+			menu->addChild(item);
+		}
+
+		menu->addChild(MenuLabel::create("Profiler"));
+
+		ProfileSaveItem *profileSaveItem = new ProfileSaveItem();
+		profileSaveItem->text = "Save profile to profile.json";
+		menu->addChild(profileSaveItem);
+
+		ProfileResetItem *profileResetItem = new ProfileResetItem();
+		profileResetItem->text = "Reset profile";
+		profileResetItem->rightText = stringf("%d overruns", engineGetOverruns());
+		menu->addChild(profileResetItem);
+
+		EngineChangeCounts changeCounts = engineGetChangeCounts();
+		uint64_t wireBlocks = changeCounts.wireCopies + changeCounts.wireSkips;
+		uint64_t statelessBlocks = changeCounts.statelessSteps + changeCounts.statelessSkips;
+		double wireSkipped = (wireBlocks > 0) ? 100.0 * changeCounts.wireSkips / wireBlocks : 0.0;
+		double statelessSkipped = (statelessBlocks > 0) ? 100.0 * changeCounts.statelessSkips / statelessBlocks : 0.0;
+		menu->addChild(MenuLabel::create(stringf("Skipped %.0f%% of cable copies, %.0f%% of stateless module steps", wireSkipped, statelessSkipped)));
+
+		menu->addChild(MenuLabel::create("Recorder"));
+
+		RecordItem *recordItem = new RecordItem();
+		if (recorderIsRecording()) {
+			recordItem->text = "Stop recording";
+			recordItem->rightText = stringf("%.0f s", recorderGetFrames() / engineGetSampleRate());
+		}
+		else {
+			recordItem->text = "Record engine input to recording.rec";
+		}
+		menu->addChild(recordItem);
 	}
 };
 
@@ -27,7 +27,7 @@ static void drawPlug(NVGcontext *vg, Vec pos, NVGcolor color) {
 	nvgFill(vg);
 }
 
-static void drawWire(NVGcontext *vg, Vec pos1, Vec pos2, NVGcolor color, float tension, float opacity) {
+static void drawWire(NVGcontext *vg, Vec pos1, Vec pos2, NVGcolor color, float thickness, float tension, float opacity) {
 	NVGcolor colorShadow = nvgRGBAf(0, 0, 0, 0.10);
 	NVGcolor colorOutline = nvgLerpRGBA(color, nvgRGBf(0.0, 0.0, 0.0), 0.5);
 
@@ -49,7 +49,7 @@ static void drawWire(NVGcontext *vg, Vec pos1, Vec pos2, NVGcolor color, float t
 		nvgMoveTo(vg, pos1.x, pos1.y);
 		nvgQuadTo(vg, pos4.x, pos4.y, pos2.x, pos2.y);
 		nvgStrokeColor(vg, colorShadow);
-		nvgStrokeWidth(vg, 5);
+		nvgStrokeWidth(vg, thickness + 2);
 		nvgStroke(vg);
 
 		// Wire outline
@@ -57,12 +57,12 @@ static void drawWire(NVGcontext *vg, Vec pos1, Vec pos2, NVGcolor color, float t
 		nvgMoveTo(vg, pos1.x, pos1.y);
 		nvgQuadTo(vg, pos3.x, pos3.y, pos2.x, pos2.y);
 		nvgStrokeColor(vg, colorOutline);
-		nvgStrokeWidth(vg, 5);
+		nvgStrokeWidth(vg, thickness + 2);
 		nvgStroke(vg);
 
 		// Wire solid
 		nvgStrokeColor(vg, color);
-		nvgStrokeWidth(vg, 3);
+		nvgStrokeWidth(vg, thickness);
 		nvgStroke(vg);
 
 		nvgRestore(vg);
@@ -176,9 +176,14 @@ void WireWidget::draw(NVGcontext *vg) {
 			opacity = 1.0;
 	}
 
+	// Draw polyphonic wires thicker
+	float thickness = 3;
+	if (wire && wire->outputModule->outputs[wire->outputId].channels > 1)
+		thickness = 5;
+
 	Vec outputPos = getOutputPos();
 	Vec inputPos = getInputPos();
-	drawWire(vg, outputPos, inputPos, color, tension, opacity);
+	drawWire(vg, outputPos, inputPos, color, thickness, tension, opacity);
 }
 
 void WireWidget::drawPlugs(NVGcontext *vg) {
@@ -0,0 +1,86 @@
+#include "arena.hpp"
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+
+
+namespace rack {
+
+
+/** Blocks are rounded up to a power of 2 times ARENA_ALIGNMENT, up to this many classes */
+static const int SIZE_CLASSES = 13;
+static const size_t MAX_CLASS_SIZE = ARENA_ALIGNMENT << (SIZE_CLASSES - 1);
+static const size_t SLAB_SIZE = 1 << 20;
+
+struct FreeBlock {
+	FreeBlock *next;
+};
+
+static FreeBlock *freeLists[SIZE_CLASSES] = {};
+/** The unused end of the newest slab */
+static char *slabPos = NULL;
+static char *slabEnd = NULL;
+
+
+/** Allocates from the heap with ARENA_ALIGNMENT, storing the heap pointer just before the block */
+static void *alignedAlloc(size_t size) {
+	void *raw = malloc(size + ARENA_ALIGNMENT);
+	if (!raw)
+		throw std::bad_alloc();
+	uintptr_t p = ((uintptr_t) raw + ARENA_ALIGNMENT) & ~(uintptr_t) (ARENA_ALIGNMENT - 1);
+	((void**) p)[-1] = raw;
+	return (void*) p;
+}
+
+static void alignedFree(void *p) {
+	free(((void**) p)[-1]);
+}
+
+static int sizeClass(size_t size) {
+	int c = 0;
+	while ((ARENA_ALIGNMENT << c) < size) {
+		c++;
+	}
+	return c;
+}
+
+
+void *arenaAlloc(size_t size) {
+	if (size > MAX_CLASS_SIZE)
+		return alignedAlloc(size);
+
+	int c = sizeClass(size);
+	size_t classSize = ARENA_ALIGNMENT << c;
+	// Reuse a freed block
+	FreeBlock *block = freeLists[c];
+	if (block) {
+		freeLists[c] = block->next;
+		return block;
+	}
+	// Carve a new block from the slab, starting a new slab if it doesn't fit.
+	// Slabs are never freed, so their blocks are recycled through the free lists.
+	if (!slabPos || (size_t) (slabEnd - slabPos) < classSize) {
+		slabPos = (char*) alignedAlloc(SLAB_SIZE);
+		slabEnd = slabPos + SLAB_SIZE;
+	}
+	void *p = slabPos;
+	slabPos += classSize;
+	return p;
+}
+
+void arenaFree(void *p, size_t size) {
+	if (!p)
+		return;
+	if (size > MAX_CLASS_SIZE) {
+		alignedFree(p);
+		return;
+	}
+
+	int c = sizeClass(size);
+	FreeBlock *block = (FreeBlock*) p;
+	block->next = freeLists[c];
+	freeLists[c] = block;
+}
+
+
+} // namespace rack
@@ -1,17 +1,92 @@
 ﻿#include "audio.hpp"
 #include "util/common.hpp"
 #include "bridge.hpp"
+#include "engine.hpp"
+#include <algorithm>
 
 
 namespace rack {
 
 
+AudioStats::AudioStats() : deviceXruns(0), underruns(0), overruns(0), timeouts(0), frames(0), lastXrunFrame(-1), latency(0), inputRatio(1.0), outputRatio(1.0), resetRequested(false) {}
+
+void AudioStats::recordCallback(int frames, int sampleRate, bool xrun) {
+	uint64_t cycles = profilerCycles();
+	if (resetRequested.exchange(false)) {
+		deviceXruns = 0;
+		underruns = 0;
+		overruns = 0;
+		timeouts = 0;
+		this->frames = 0;
+		lastXrunFrame = -1;
+		inputFill.reset();
+		outputFill.reset();
+		callbackInterval.reset();
+		callbackJitter.reset();
+		lastCallbackCycles = 0;
+	}
+	if (lastCallbackCycles > 0 && sampleRate > 0) {
+		int64_t interval = cycles - lastCallbackCycles;
+		int64_t expected = (double) frames / sampleRate * profilerCyclesPerSecond();
+		callbackInterval.record(interval);
+		callbackJitter.record((interval > expected) ? interval - expected : expected - interval);
+	}
+	lastCallbackCycles = cycles;
+	if (xrun) {
+		deviceXruns++;
+		recordXrun();
+	}
+	this->frames += frames;
+}
+
+void AudioStats::recordXrun() {
+	lastXrunFrame = frames.load();
+}
+
+int AudioStats::getXruns() const {
+	return deviceXruns + underruns + overruns + timeouts;
+}
+
+/** Fill levels are in frames, and the low percentile shows how close the FIFO came to running dry */
+static json_t *fillToJson(const ProfilerHistogram &fill) {
+	json_t *fillJ = fill.toJson(1.0);
+	json_object_set_new(fillJ, "p1", json_real(fill.percentile(0.01f)));
+	return fillJ;
+}
+
+json_t *AudioStats::toJson(int sampleRate) const {
+	double secondsPerCycle = 1.0 / profilerCyclesPerSecond();
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, "deviceXruns", json_integer(deviceXruns));
+	json_object_set_new(rootJ, "underruns", json_integer(underruns));
+	json_object_set_new(rootJ, "overruns", json_integer(overruns));
+	json_object_set_new(rootJ, "timeouts", json_integer(timeouts));
+	json_object_set_new(rootJ, "frames", json_integer(frames));
+	int64_t lastXrun = lastXrunFrame;
+	json_object_set_new(rootJ, "lastXrunTime", (lastXrun >= 0 && sampleRate > 0) ? json_real((double) lastXrun / sampleRate) : json_null());
+	json_object_set_new(rootJ, "inputFill", fillToJson(inputFill));
+	json_object_set_new(rootJ, "outputFill", fillToJson(outputFill));
+	json_object_set_new(rootJ, "callbackInterval", callbackInterval.toJson(secondsPerCycle));
+	json_object_set_new(rootJ, "callbackJitter", callbackJitter.toJson(secondsPerCycle));
+	json_object_set_new(rootJ, "latency", json_integer(latency));
+	json_object_set_new(rootJ, "inputRatio", json_real(inputRatio));
+	json_object_set_new(rootJ, "outputRatio", json_real(outputRatio));
+	return rootJ;
+}
+
+
+/** Every AudioIO, for audioGetStatsJson(). Only the UI thread uses it. */
+static std::vector<AudioIO*> audioIOs;
+
+
 AudioIO::AudioIO() {
 	setDriver(RtAudio::UNSPECIFIED);
+	audioIOs.push_back(this);
 }
 
 AudioIO::~AudioIO() {
 	closeStream();
+	audioIOs.erase(std::remove(audioIOs.begin(), audioIOs.end(), this), audioIOs.end());
 }
 
 std::vector<int> AudioIO::getDrivers() {
@@ -204,6 +279,7 @@ void AudioIO::setChannels(int numOutputs, int numInputs) {
 static int rtCallback(void *outputBuffer, void *inputBuffer, unsigned int nFrames, double streamTime, RtAudioStreamStatus status, void *userData) {
 	AudioIO *audioIO = (AudioIO*) userData;
 	assert(audioIO);
+	audioIO->stats.recordCallback(nFrames, audioIO->sampleRate, status != 0);
 	audioIO->processStream((const float *) inputBuffer, (float *) outputBuffer, nFrames);
 	return 0;
 }
@@ -211,6 +287,8 @@ static int rtCallback(void *outputBuffer, void *inputBuffer, unsigned int nFrame
 void AudioIO::openStream() {
 	if (device < 0)
 		return;
+	// Measure each stream from its start
+	stats.resetRequested = true;
 
 	if (rtAudio) {
 		// Open new device
@@ -253,6 +331,14 @@ void AudioIO::openStream() {
 			}
 		}
 
+		// Only a callback thread which steps the engine gets the engine's priority, so other devices can't preempt the engine.
+		// The priority is fixed until the stream is reopened, even if the clock moves.
+		const EngineRealtimeSettings &realtime = engineGetRealtimeSettings();
+		if (realtime.realtime && isEngineClock(closestSampleRate)) {
+			options.flags |= RTAUDIO_SCHEDULE_REALTIME;
+			options.priority = realtime.priority;
+		}
+
 		try {
 			info("Opening audio RtAudio device %d with %d in %d out", device, numInputs, numOutputs);
 			rtAudio->openStream(
@@ -366,5 +452,28 @@ void AudioIO::fromJson(json_t *rootJ) {
 	openStream();
 }
 
+json_t *AudioIO::statsToJson() {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, "driver", json_string(getDriverName(driver).c_str()));
+	json_object_set_new(rootJ, "device", json_string(getDeviceDetail(device, offset).c_str()));
+	json_object_set_new(rootJ, "sampleRate", json_integer(sampleRate));
+	json_object_set_new(rootJ, "blockSize", json_integer(blockSize));
+	json_object_set_new(rootJ, "inputs", json_integer(numInputs));
+	json_object_set_new(rootJ, "outputs", json_integer(numOutputs));
+	json_object_set_new(rootJ, "stats", stats.toJson(sampleRate));
+	return rootJ;
+}
+
+
+json_t *audioGetStatsJson() {
+	json_t *audioJ = json_array();
+	for (AudioIO *audioIO : audioIOs) {
+		if (audioIO->device < 0 || (audioIO->numInputs == 0 && audioIO->numOutputs == 0))
+			continue;
+		json_array_append_new(audioJ, audioIO->statsToJson());
+	}
+	return audioJ;
+}
+
 
 } // namespace rack
@@ -214,6 +214,7 @@ struct BridgeClientConnection {
 		if (!audioListeners[port])
 			return;
 		audioListeners[port]->setBlockSize(frames);
+		audioListeners[port]->stats.recordCallback(frames, audioListeners[port]->sampleRate, false);
 		audioListeners[port]->processStream(input, output, frames);
 	}
 
@@ -1,15 +1,33 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <assert.h>
 #include <math.h>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <xmmintrin.h>
 #include <pmmintrin.h>
 
+#if ARCH_LIN || ARCH_MAC
+	#include <pthread.h>
+	#include <sched.h>
+	#include <sys/mman.h>
+#endif
+#if ARCH_WIN
+	#include <windows.h>
+#endif
+
 #include "engine.hpp"
+#include "recorder.hpp"
+#include "dsp/resampler.hpp"
 
 
 namespace rack {
@@ -20,21 +38,292 @@ std::vector<Wire*> gWires;
 bool gPowerMeter = false;
 
 static bool running = false;
+/** Whether the calling thread is stepping the engine with engineRenderBlock(), so events are queued for their frame */
+static bool rendering = false;
 static float sampleRate = 44100.f;
 static float sampleTime = 1.f / sampleRate;
-static float sampleRateRequested = sampleRate;
 
-static Module *resetModule = NULL;
-static Module *randomizeModule = NULL;
+static int blockSize = 1;
+static int blockSizeRequested = 1;
+static int threadCount = 1;
+static int threadCountRequested = 1;
+
+/** The oversampling factor of the module being stepped by this thread, or 1 */
+static thread_local int stepOversample = 1;
+/** The module being stepped by this thread, and the engine frame of the first frame of its current process() call */
+static thread_local Module *steppingModule = NULL;
+static thread_local int64_t processFrame = 0;
+/** The engine frame of the module's current step() */
+static thread_local int64_t stepFrame = 0;
+/** 0 on the threads which step the engine, and the index of each worker thread on workers */
+static thread_local int stepThreadIndex = 0;
+
+static EngineRealtimeSettings realtimeSettings;
+static bool memoryLocked = false;
+
+/** The number of frames stepped before the current block */
+static std::atomic<int64_t> frameCounter(0);
+/** The engine frame at steady clock time 0, estimated from the time each block finishes, for timestamping device messages */
+static std::atomic<double> frameOrigin(0.0);
 
-static std::mutex mutex;
 static std::thread thread;
-static VIPMutex vipMutex;
+/** The module whose audio device callback steps the engine, or NULL if the engine thread keeps time by itself */
+static std::atomic<Module*> clockModule(NULL);
+/** Held by whichever thread is currently stepping the engine */
+static std::atomic_flag stepLock = ATOMIC_FLAG_INIT;
+
+/** The engine thread's copy of the patch.
+The UI thread owns `gModules` and `gWires` and sends edits through the command queue, which the engine thread applies between blocks.
+*/
+static std::vector<Module*> modules;
+static std::vector<Wire> wires;
+/** The modules which are stepped each block.
+Leaves out bypassed modules, and output-only modules with no outputs plugged in.
+*/
+static std::vector<Module*> runnableModules;
+/** Index of each module in `modules` and `runnableModules`, and of each wire in `wires` by its input, so edits take constant time regardless of patch size.
+Vectors are kept compact by moving their last element into the removed slot.
+*/
+static std::unordered_map<const Module*, size_t> moduleIndex;
+static std::unordered_map<const Module*, size_t> runnableIndex;
+static std::unordered_map<const Input*, size_t> wireIndex;
+/** Number of wires plugged into each output which has any */
+static std::unordered_map<const Output*, int> outputWireCounts;
+
+/** The UI thread's index of `gModules` and `gWires`, and the number of wire ends plugged into each module */
+static std::unordered_map<const Module*, size_t> uiModuleIndex;
+static std::unordered_map<const Wire*, size_t> uiWireIndex;
+static std::unordered_set<const Input*> uiPluggedInputs;
+static std::unordered_map<const Module*, int> uiModuleWireCounts;
+
+struct EngineCommand {
+	enum Type {
+		ADD_MODULE,
+		REMOVE_MODULE,
+		ADD_WIRE,
+		REMOVE_WIRE,
+		SET_BYPASS,
+		SET_OVERSAMPLE,
+	};
+	Type type;
+	Module *module;
+	bool bypassed;
+	int oversample;
+	ModuleOversampler *oversampler;
+	/** A copy of the wire's endpoints, so the Wire can be deleted before the command is applied */
+	Wire wire;
+};
+
+/** Single-producer single-consumer queue from the UI thread to the engine thread.
+The UI thread only waits when the queue is full or when it must know the engine has let go of a module.
+*/
+static const uint32_t commandQueueSize = 1 << 12;
+static EngineCommand commandQueue[commandQueueSize];
+static std::atomic<uint32_t> commandQueueStart(0);
+static std::atomic<uint32_t> commandQueueEnd(0);
+
+/** While the power meter is enabled, every block is timed, and modules are timed one block in this many */
+static const int profileDivision = 16;
+static int profileCounter = 0;
+static bool profileModules = false;
+/** Re-estimated on each block which profiles modules */
+static double profileSecondsPerCycle = 1e-9;
+static ProfilerHistogram blockProfile;
+static int overruns = 0;
+static std::atomic<bool> profileResetRequested(false);
+
+/** Plug lights are only drawn at the screen's frame rate, so they are updated from the peaks of the blocks since their last update every this many frames */
+static const int portLightsDivision = 64;
+static int portLightsCounter = 0;
+/** The number of frames since plug lights were last updated if they are updated this block, otherwise 0 */
+static int portLightsFrames = 0;
+
+/** Cables compiled into parallel arrays of their ports, so stepping cables is a linear copy loop.
+Parallel to `wires`.
+*/
+static std::vector<const Output*> wireOutputs;
+static std::vector<Input*> wireInputs;
+/** The number of frames at the start of each cable's input block which hold its output's last voltage, so an unchanged output doesn't need to be copied into a block no longer than that.
+Counting frames rather than flagging steady inputs keeps the skip across blocks shortened to fit an audio device's buffer.
+*/
+static std::vector<uint16_t> wireSteadyFrames;
+
+/** Counted while the power meter is enabled. Stateless modules are counted from worker threads. */
+static bool countChanges = false;
+static uint64_t wireCopies = 0;
+static uint64_t wireSkips = 0;
+static std::atomic<uint64_t> statelessSteps(0);
+static std::atomic<uint64_t> statelessSkips(0);
+
+/** Bounded multi-producer single-consumer queue.
+push() never blocks and returns false if the queue is full. shift() must only be called by one thread.
+S must be a power of 2.
+*/
+template <typename T, size_t S>
+struct MpscQueue {
+	struct Slot {
+		/** Equal to the index of the next push when empty, or the index of the push plus 1 when filled */
+		std::atomic<size_t> sequence;
+		T value;
+	};
+	Slot slots[S];
+	std::atomic<size_t> end;
+	size_t start = 0;
+
+	MpscQueue() : end(0) {
+		for (size_t i = 0; i < S; i++) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	bool push(const T &t) {
+		size_t e = end.load(std::memory_order_relaxed);
+		while (true) {
+			Slot &slot = slots[e & (S - 1)];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t) sequence - (intptr_t) e;
+			if (diff == 0) {
+				// Claim the slot
+				if (end.compare_exchange_weak(e, e + 1, std::memory_order_relaxed)) {
+					slot.value = t;
+					slot.sequence.store(e + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				// The consumer hasn't shifted this slot yet
+				return false;
+			}
+			else {
+				// Another producer claimed the slot
+				e = end.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	bool shift(T *t) {
+		Slot &slot = slots[start & (S - 1)];
+		size_t sequence = slot.sequence.load(std::memory_order_acquire);
+		if (sequence != start + 1)
+			return false;
+		*t = slot.value;
+		slot.sequence.store(start + S, std::memory_order_release);
+		start++;
+		return true;
+	}
+};
 
 // Parameter interpolation
-static Module *smoothModule = NULL;
-static int smoothParamId;
-static float smoothValue;
+struct SmoothParam {
+	Module *module;
+	int paramId;
+	/** Target value */
+	float value;
+	/** Decay rate in 1/seconds */
+	float lambda;
+};
+
+/** Requests from engineSetParamSmooth(), which may be called from any thread */
+static MpscQueue<SmoothParam, (1<<12)> smoothQueue;
+/** Params currently being smoothed by the engine thread */
+static const int smoothParamsSize = 256;
+static SmoothParam smoothParams[smoothParamsSize];
+static int smoothParamsLen = 0;
+
+struct EngineEvent {
+	enum Type {
+		SET_PARAM,
+		RESET,
+		RANDOMIZE,
+		SAMPLE_RATE,
+		MIDI_MESSAGE,
+	};
+	Type type;
+	/** NULL for events which apply to the whole engine */
+	Module *module;
+	int paramId;
+	float value;
+	MidiMessage message;
+	/** The engine frame at which the event applies. Past frames apply at the start of the next block. */
+	int64_t frame;
+	/** Frame within the current block, assigned by the engine thread */
+	int offset;
+	/** Order of arrival, so events at the same frame apply in the order they were sent */
+	uint32_t sequence;
+};
+
+/** Events from any thread, which the engine thread applies at their frame.
+Senders wait when the queue is full rather than dropping events.
+*/
+static const int eventsSize = 1 << 12;
+static MpscQueue<EngineEvent, eventsSize> eventQueue;
+/** Events shifted from the queue which are not yet due */
+static EngineEvent pendingEvents[eventsSize];
+static int pendingEventsLen = 0;
+static uint32_t eventSequence = 0;
+/** Events due in the current block, sorted by module and then by frame */
+static EngineEvent blockEvents[eventsSize];
+static int blockEventsLen = 0;
+
+
+/** Blocks until `total` threads have called wait().
+Spins for a short time before yielding, since threads usually arrive within a fraction of a sample.
+Threads still waiting after 50 ms, such as workers while the engine is paused or between the callbacks of a stalled device, sleep on a condition variable until the last thread arrives.
+*/
+struct SpinBarrier {
+	int total = 0;
+	std::atomic<int> count;
+	std::atomic<int> generation;
+	/** Threads sleeping on `cv`. The last thread only locks `mutex` to wake them if there are any. */
+	std::atomic<int> sleepers;
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	SpinBarrier() : count(0), generation(0), sleepers(0) {}
+
+	void wait() {
+		int g = generation.load(std::memory_order_acquire);
+		if (count.fetch_add(1, std::memory_order_acq_rel) == total - 1) {
+			// Last thread to arrive releases the others.
+			// Sequentially consistent with the sleepers' increment and check, so either a sleeper sees the new generation or this sees the sleeper.
+			count.store(0, std::memory_order_relaxed);
+			generation.fetch_add(1);
+			if (sleepers.load() > 0) {
+				std::lock_guard<std::mutex> lock(mutex);
+				cv.notify_all();
+			}
+			return;
+		}
+		int spins = 0;
+		while (generation.load(std::memory_order_acquire) == g) {
+			if (++spins < 10000)
+				continue;
+			auto startTime = std::chrono::steady_clock::now();
+			auto parkTimeout = std::chrono::milliseconds(50);
+			while (generation.load(std::memory_order_acquire) == g) {
+				if (std::chrono::steady_clock::now() - startTime < parkTimeout) {
+					std::this_thread::yield();
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(mutex);
+				sleepers++;
+				cv.wait(lock, [&] {
+					return generation.load() != g;
+				});
+				sleepers--;
+			}
+		}
+	}
+};
+
+/** Worker threads step a share of the engine's modules each frame, alongside the engine thread.
+Cables introduce a one-frame delay, so modules never depend on each other within a frame and can be stepped in any order.
+The barriers are the sample-accurate handoff between the module stage and the cable stage of each frame.
+*/
+static std::vector<std::thread> workers;
+static bool workersRunning = false;
+static SpinBarrier workerStartBarrier;
+static SpinBarrier workerEndBarrier;
+/** The next index of `modules` to be claimed by a thread */
+static std::atomic<int> workerModuleIndex(0);
 
 
 float Light::getBrightness() {
@@ -47,7 +336,7 @@ void Light::setBrightnessSmooth(float brightness, float frames) {
 	float v = (brightness > 0.f) ? brightness * brightness : 0.f;
 	if (v < value) {
 		// Fade out light with lambda = framerate
-		value += (v - value) * sampleTime * frames * 60.f;
+		value += (v - value) * engineGetSampleTime() * frames * 60.f;
 	}
 	else {
 		// Immediately illuminate light
@@ -56,9 +345,195 @@ void Light::setBrightnessSmooth(float brightness, float frames) {
 }
 
 
+void Module::process(int frames) {
+	for (int i = 0; i < frames; i++) {
+		stepFrame = processFrame + i / stepOversample;
+		for (Input &input : inputs) {
+			input.value = input.buffer[i];
+			for (int c = 1; c < input.channels; c++) {
+				input.voltages[c] = input.getBuffer(c)[i];
+			}
+		}
+		step();
+		for (Output &output : outputs) {
+			for (int c = 0; c < output.channels; c++) {
+				output.getBuffer(c)[i] = output.voltages[c];
+			}
+		}
+	}
+}
+
+
+/** Steps a module at a multiple of the engine's sample rate by swapping its port buffers for oversampled ones */
+struct ModuleOversampler {
+	virtual ~ModuleOversampler() {}
+	virtual void process(Module *module, int frames) = 0;
+};
+
+template <int OVERSAMPLE>
+struct TModuleOversampler : ModuleOversampler {
+	static const int QUALITY = 8;
+	/** Frames at the engine's rate which fill an oversampled block of ENGINE_MAX_BLOCK_SIZE frames */
+	static const int CHUNK_SIZE = ENGINE_MAX_BLOCK_SIZE / OVERSAMPLE;
+	/** Resampling state of each channel of each input, and of each output */
+	std::vector<Upsampler<OVERSAMPLE, QUALITY>> upsamplers;
+	std::vector<Decimator<OVERSAMPLE, QUALITY>> decimators;
+	/** Oversampled block of each channel of each input followed by each output, laid out like the engine's port buffers */
+	std::vector<float> buffers;
+	/** The engine's buffer of each input followed by each output, while they are swapped out */
+	std::vector<float*> portBuffers;
+	/** The number of channels of each input upsampled by the previous chunk */
+	std::vector<int> inputChannels;
+
+	/** The first channel of each input followed by each output, indexing the resampling state and the blocks of `buffers` */
+	std::vector<int> portChannels;
+
+	TModuleOversampler(Module *module) {
+		int channels = 0;
+		for (const Input &input : module->inputs) {
+			portChannels.push_back(channels);
+			channels += input.maxChannels;
+		}
+		upsamplers.resize(channels);
+		for (const Output &output : module->outputs) {
+			portChannels.push_back(channels);
+			channels += output.maxChannels;
+		}
+		decimators.resize(channels - upsamplers.size());
+		buffers.assign(channels * ENGINE_MAX_BLOCK_SIZE, 0.f);
+		portBuffers.resize(module->inputs.size() + module->outputs.size());
+		inputChannels.assign(module->inputs.size(), 0);
+	}
+
+	void process(Module *module, int frames) override {
+		int inputsLen = module->inputs.size();
+		int outputsLen = module->outputs.size();
+
+		// Point the ports at the oversampled blocks
+		for (int j = 0; j < inputsLen; j++) {
+			Input &input = module->inputs[j];
+			portBuffers[j] = input.buffer;
+			input.buffer = &buffers[portChannels[j] * ENGINE_MAX_BLOCK_SIZE];
+		}
+		for (int j = 0; j < outputsLen; j++) {
+			Output &output = module->outputs[j];
+			portBuffers[inputsLen + j] = output.buffer;
+			output.buffer = &buffers[portChannels[inputsLen + j] * ENGINE_MAX_BLOCK_SIZE];
+		}
+
+		// Decimators are indexed from the first output channel
+		int inputsChannels = upsamplers.size();
+
+		// Step the module at the higher rate, one oversampled block at a time
+		stepOversample = OVERSAMPLE;
+		int64_t startFrame = processFrame;
+		for (int frame = 0; frame < frames; frame += CHUNK_SIZE) {
+			int chunk = std::min(CHUNK_SIZE, frames - frame);
+
+			// Upsample each channel of the inputs
+			for (int j = 0; j < inputsLen; j++) {
+				Input &input = module->inputs[j];
+				for (int c = 0; c < input.channels; c++) {
+					const float *in = portBuffers[j] + c * ENGINE_MAX_BLOCK_SIZE + frame;
+					float *out = input.getBuffer(c);
+					Upsampler<OVERSAMPLE, QUALITY> &upsampler = upsamplers[portChannels[j] + c];
+					for (int i = 0; i < chunk; i++) {
+						upsampler.process(in[i], &out[i * OVERSAMPLE]);
+					}
+				}
+				// Zero channels which are no longer carried, including the first channel of unplugged inputs
+				for (int c = input.channels; c < inputChannels[j]; c++) {
+					upsamplers[portChannels[j] + c].reset();
+					memset(input.getBuffer(c), 0, sizeof(float) * ENGINE_MAX_BLOCK_SIZE);
+				}
+				inputChannels[j] = input.channels;
+			}
+
+			processFrame = startFrame + frame;
+			module->process(chunk * OVERSAMPLE);
+
+			// Decimate each channel of the outputs into the engine's blocks
+			for (int j = 0; j < outputsLen; j++) {
+				Output &output = module->outputs[j];
+				for (int c = 0; c < output.channels; c++) {
+					float *in = output.getBuffer(c);
+					float *out = portBuffers[inputsLen + j] + c * ENGINE_MAX_BLOCK_SIZE + frame;
+					Decimator<OVERSAMPLE, QUALITY> &decimator = decimators[portChannels[inputsLen + j] - inputsChannels + c];
+					for (int i = 0; i < chunk; i++) {
+						out[i] = decimator.process(&in[i * OVERSAMPLE]);
+					}
+				}
+			}
+		}
+		stepOversample = 1;
+		processFrame = startFrame;
+
+		// Restore the engine's port buffers
+		for (int j = 0; j < inputsLen; j++) {
+			module->inputs[j].buffer = portBuffers[j];
+		}
+		for (int j = 0; j < outputsLen; j++) {
+			module->outputs[j].buffer = portBuffers[inputsLen + j];
+		}
+	}
+};
+
+/** Returns NULL if `oversample` is 1 */
+static ModuleOversampler *createOversampler(Module *module, int oversample) {
+	switch (oversample) {
+		case 2: return new TModuleOversampler<2>(module);
+		case 4: return new TModuleOversampler<4>(module);
+		case 8: return new TModuleOversampler<8>(module);
+		default: return NULL;
+	}
+}
+
+
+/** Returns the number of channels a wire carries from the output to the input */
+static int wireChannels(const Output &output, const Input &input) {
+	return std::min(output.channels, input.maxChannels);
+}
+
+/** Copies the channel count and the voltage of each channel to the input, zeroing channels which are no longer carried */
+static void stepWireVoltages(const Output &output, Input &input) {
+	int channels = wireChannels(output, input);
+	if (input.channels > channels)
+		memset(&input.voltages[channels], 0, sizeof(float) * (input.channels - channels));
+	memcpy(input.voltages, output.voltages, sizeof(float) * channels);
+	input.channels = channels;
+}
+
+/** Copies `frames` frames of the block of each channel to the input, zeroing the blocks of channels which are no longer carried */
+static void stepWireChannels(const Output &output, Input &input, int frames) {
+	int channels = wireChannels(output, input);
+	if (frames == ENGINE_MAX_BLOCK_SIZE) {
+		memcpy(input.buffer, output.buffer, sizeof(float) * ENGINE_MAX_BLOCK_SIZE * channels);
+	}
+	else if (frames == 1) {
+		for (int c = 0; c < channels; c++) {
+			input.buffer[c * ENGINE_MAX_BLOCK_SIZE] = output.buffer[c * ENGINE_MAX_BLOCK_SIZE];
+		}
+	}
+	else {
+		for (int c = 0; c < channels; c++) {
+			memcpy(&input.buffer[c * ENGINE_MAX_BLOCK_SIZE], &output.buffer[c * ENGINE_MAX_BLOCK_SIZE], sizeof(float) * frames);
+		}
+	}
+	if (input.channels > channels)
+		memset(&input.buffer[channels * ENGINE_MAX_BLOCK_SIZE], 0, sizeof(float) * ENGINE_MAX_BLOCK_SIZE * (input.channels - channels));
+	stepWireVoltages(output, input);
+}
+
 void Wire::step() {
-	float value = outputModule->outputs[outputId].value;
-	inputModule->inputs[inputId].value = value;
+	const Output &output = outputModule->outputs[outputId];
+	Input &input = inputModule->inputs[inputId];
+	stepWireVoltages(output, input);
+}
+
+void Wire::stepBlock(int frames) {
+	const Output &output = outputModule->outputs[outputId];
+	Input &input = inputModule->inputs[inputId];
+	stepWireChannels(output, input, frames);
 }
 
 
@@ -71,109 +546,873 @@ void engineDestroy() {
 	assert(gModules.empty());
 }
 
-static void engineStep() {
-	// Sample rate
-	if (sampleRateRequested != sampleRate) {
-		sampleRate = sampleRateRequested;
-		sampleTime = 1.f / sampleRate;
-		for (Module *module : gModules) {
-			module->onSampleRateChange();
+/** Accumulates the positive and negative peaks of the block of each channel of a port, and sets its pair of plug lights from them when they are updated */
+static void stepPlugLights(Light *plugLights, float *plugPeaks, const float *buffer, int channels) {
+	float maxValue = plugPeaks[0];
+	float minValue = plugPeaks[1];
+	for (int c = 0; c < std::max(channels, 1); c++) {
+		const float *channelBuffer = &buffer[c * ENGINE_MAX_BLOCK_SIZE];
+		for (int i = 0; i < blockSize; i++) {
+			maxValue = fmaxf(maxValue, channelBuffer[i]);
+			minValue = fminf(minValue, channelBuffer[i]);
 		}
 	}
+	if (portLightsFrames > 0) {
+		plugLights[0].setBrightnessSmooth(maxValue / 5.f, portLightsFrames);
+		plugLights[1].setBrightnessSmooth(-minValue / 5.f, portLightsFrames);
+		maxValue = 0.f;
+		minValue = 0.f;
+	}
+	plugPeaks[0] = maxValue;
+	plugPeaks[1] = minValue;
+}
 
-	// Events
-	if (resetModule) {
-		resetModule->onReset();
-		resetModule = NULL;
+static void stepPortLights(Module *module) {
+	for (Input &input : module->inputs) {
+		if (input.active) {
+			stepPlugLights(input.plugLights, input.plugPeaks, input.buffer, input.channels);
+		}
+	}
+	for (Output &output : module->outputs) {
+		if (output.active) {
+			stepPlugLights(output.plugLights, output.plugPeaks, output.buffer, output.channels);
+		}
 	}
-	if (randomizeModule) {
-		randomizeModule->onRandomize();
-		randomizeModule = NULL;
+}
+
+static void setSampleRate(float newSampleRate) {
+	sampleRate = newSampleRate;
+	sampleTime = 1.f / sampleRate;
+	for (Module *module : modules) {
+		stepOversample = module->oversample;
+		module->onSampleRateChange();
+		module->paramsChanged = true;
 	}
+	stepOversample = 1;
+}
 
-	// Param smoothing
-	{
-		Module *localSmoothModule = smoothModule;
-		int localSmoothParamId = smoothParamId;
-		float localSmoothValue = smoothValue;
-		if (localSmoothModule) {
-			float value = localSmoothModule->params[localSmoothParamId].value;
-			const float lambda = 60.0; // decay rate is 1 graphics frame
-			float delta = localSmoothValue - value;
-			float newValue = value + delta * lambda * sampleTime;
-			if (value == newValue) {
-				// Snap to actual smooth value if the value doesn't change enough (due to the granularity of floats)
-				localSmoothModule->params[localSmoothParamId].value = localSmoothValue;
-				smoothModule = NULL;
+static void applyEvent(const EngineEvent &event) {
+	if (event.module)
+		event.module->paramsChanged = true;
+	switch (event.type) {
+		case EngineEvent::SET_PARAM: {
+			event.module->params[event.paramId].value = event.value;
+		} break;
+		case EngineEvent::RESET: {
+			event.module->onReset();
+		} break;
+		case EngineEvent::RANDOMIZE: {
+			event.module->onRandomize();
+		} break;
+		case EngineEvent::SAMPLE_RATE: {
+			setSampleRate(event.value);
+		} break;
+		case EngineEvent::MIDI_MESSAGE: {
+			event.module->onMidiMessage(event.message);
+		} break;
+	}
+}
+
+static bool compareBlockEvents(const EngineEvent &a, const EngineEvent &b) {
+	if (a.module != b.module)
+		return std::less<Module*>()(a.module, b.module);
+	if (a.offset != b.offset)
+		return a.offset < b.offset;
+	return a.sequence < b.sequence;
+}
+
+/** Moves events from the queue to the pending events, leaving them in the queue if there is no room */
+static void shiftEventQueue() {
+	while (pendingEventsLen < eventsSize && eventQueue.shift(&pendingEvents[pendingEventsLen])) {
+		// Drop events sent by devices to a module after it was removed
+		const Module *module = pendingEvents[pendingEventsLen].module;
+		if (module && moduleIndex.find(module) == moduleIndex.end())
+			continue;
+		pendingEvents[pendingEventsLen].sequence = eventSequence++;
+		pendingEventsLen++;
+	}
+}
+
+static double getSteadyTime() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void recordEvent(const EngineEvent &event, int64_t frame) {
+	switch (event.type) {
+		case EngineEvent::SET_PARAM: {
+			recorderParam(event.module, frame, event.paramId, event.value);
+		} break;
+		case EngineEvent::RESET: {
+			recorderReset(event.module, frame);
+		} break;
+		case EngineEvent::RANDOMIZE: {
+			recorderRandomize(event.module, frame);
+		} break;
+		case EngineEvent::SAMPLE_RATE: {
+			recorderSampleRate(frame, event.value);
+		} break;
+		case EngineEvent::MIDI_MESSAGE: {
+			recorderMidiMessage(event.module, frame, event.message);
+		} break;
+	}
+}
+
+/** Moves pending events due in the current block to `blockEvents`.
+Events for the whole engine, and for modules which are not stepped this block, are applied immediately.
+*/
+static void collectEvents() {
+	shiftEventQueue();
+	int64_t blockFrame = frameCounter.load(std::memory_order_relaxed);
+	blockEventsLen = 0;
+	for (int i = 0; i < pendingEventsLen;) {
+		EngineEvent &event = pendingEvents[i];
+		if (event.frame >= blockFrame + blockSize) {
+			i++;
+			continue;
+		}
+		event.offset = max_rack((int) (event.frame - blockFrame), 0);
+		blockEvents[blockEventsLen++] = event;
+		// Remove by moving the last event into this slot
+		pendingEvents[i] = pendingEvents[--pendingEventsLen];
+	}
+	// Sorting first makes the order events apply in independent of the order of the queue, and puts events for the whole engine first
+	std::sort(blockEvents, blockEvents + blockEventsLen, compareBlockEvents);
+
+	bool recording = recorderIsRecording();
+	int len = 0;
+	for (int i = 0; i < blockEventsLen; i++) {
+		const EngineEvent &event = blockEvents[i];
+		if (recording)
+			recordEvent(event, blockFrame + event.offset);
+		if (!event.module || runnableIndex.find(event.module) == runnableIndex.end())
+			applyEvent(event);
+		else
+			blockEvents[len++] = event;
+	}
+	blockEventsLen = len;
+}
+
+/** Moves the buffer of each port of `module` forward by `frames` */
+static void offsetPortBuffers(Module *module, int frames) {
+	for (Input &input : module->inputs) {
+		input.buffer += frames;
+	}
+	for (Output &output : module->outputs) {
+		output.buffer += frames;
+	}
+}
+
+/** Processes `frames` frames of the block starting at `offset` */
+static void processModule(Module *module, int offset, int frames) {
+	if (offset > 0)
+		offsetPortBuffers(module, offset);
+	processFrame = frameCounter.load(std::memory_order_relaxed) + offset;
+	stepFrame = processFrame;
+	if (module->oversampler)
+		module->oversampler->process(module, frames);
+	else
+		module->process(frames);
+	if (offset > 0)
+		offsetPortBuffers(module, -offset);
+}
+
+/** Processes the block in slices between the frames of the module's events, applying each event at its frame */
+static void processModuleEvents(Module *module, const EngineEvent *events, int eventsLen) {
+	int frame = 0;
+	for (int i = 0; i < eventsLen; i++) {
+		const EngineEvent &event = events[i];
+		if (event.offset > frame) {
+			processModule(module, frame, event.offset - frame);
+			frame = event.offset;
+		}
+		applyEvent(event);
+	}
+	if (frame < blockSize) {
+		processModule(module, frame, blockSize - frame);
+	}
+}
+
+static void stepModule(Module *module) {
+	uint64_t startCycles = 0;
+	if (profileModules) {
+		startCycles = profilerCycles();
+	}
+
+	// Find the module's events for this block
+	const EngineEvent *events = std::lower_bound(blockEvents, blockEvents + blockEventsLen, module, [](const EngineEvent &event, Module *module) {
+		return std::less<Module*>()(event.module, module);
+	});
+	int eventsLen = 0;
+	while (events + eventsLen < blockEvents + blockEventsLen && events[eventsLen].module == module) {
+		eventsLen++;
+	}
+	// A stateless module's outputs are already constant at the voltages it would write, as long as nothing it reads has changed
+	bool skip = module->stateless && eventsLen == 0 && !module->paramsChanged && module->steadyFrames >= blockSize;
+	if (skip) {
+		for (const Input &input : module->inputs) {
+			if (input.changed) {
+				skip = false;
+				break;
 			}
-			else {
-				localSmoothModule->params[localSmoothParamId].value = newValue;
+		}
+	}
+	if (skip) {
+		for (const Output &output : module->outputs) {
+			if (output.changed) {
+				skip = false;
+				break;
 			}
 		}
 	}
+	if (module->stateless && countChanges) {
+		(skip ? statelessSkips : statelessSteps).fetch_add(1, std::memory_order_relaxed);
+	}
 
-	// Step modules
-	for (Module *module : gModules) {
-		std::chrono::high_resolution_clock::time_point startTime;
-		if (gPowerMeter) {
-			startTime = std::chrono::high_resolution_clock::now();
+	if (!skip) {
+		steppingModule = module;
+		if (eventsLen > 0)
+			processModuleEvents(module, events, eventsLen);
+		else
+			processModule(module, 0, blockSize);
+		steppingModule = NULL;
+		// Keep the voltages of block-based modules current for modules and widgets which read them
+		for (Input &input : module->inputs) {
+			for (int c = 0; c < std::max(input.channels, 1); c++) {
+				input.voltages[c] = input.getBuffer(c)[blockSize - 1];
+			}
+		}
+		for (Output &output : module->outputs) {
+			for (int c = 0; c < output.channels; c++) {
+				output.voltages[c] = output.getBuffer(c)[blockSize - 1];
+			}
+			// Stateless modules check all of their outputs before skipping, but other modules only need the outputs wires copy
+			if (!output.active && !module->stateless)
+				continue;
+			bool changed = false;
+			for (int c = 0; c < output.channels && !changed; c++) {
+				const float *buffer = output.getBuffer(c);
+				for (int i = 0; i < blockSize; i++) {
+					if (buffer[i] != output.lastVoltages[c]) {
+						changed = true;
+						break;
+					}
+				}
+			}
+			output.changed = changed;
+			memcpy(output.lastVoltages, output.voltages, sizeof(float) * output.channels);
+		}
+		if (module->stateless) {
+			bool changed = false;
+			for (const Output &output : module->outputs) {
+				changed = changed || output.changed;
+			}
+			module->steadyFrames = changed ? 0 : std::max(module->steadyFrames, blockSize);
+		}
+	}
+	module->paramsChanged = false;
+	// Unplugged inputs stay at 0V after the block they were unplugged
+	for (Input &input : module->inputs) {
+		if (!input.active)
+			input.changed = false;
+	}
+
+	if (profileModules) {
+		uint64_t cycles = profilerCycles() - startCycles;
+		module->profile.record(cycles / blockSize);
+		float cpuTime = cycles * profileSecondsPerCycle * sampleRate / blockSize;
+		module->cpuTime += (cpuTime - module->cpuTime) * fminf(sampleTime * blockSize * profileDivision / 0.5f, 1.f);
+	}
+
+	stepPortLights(module);
+}
+
+/** Steps modules claimed from `workerModuleIndex` until none are left */
+static void stepModules() {
+	int modulesLen = runnableModules.size();
+	while (true) {
+		int i = workerModuleIndex++;
+		if (i >= modulesLen)
+			break;
+		stepModule(runnableModules[i]);
+	}
+}
+
+/** Writes to each page of the stack that stepping is likely to use, so the pages are resident before audio depends on them */
+static void prefaultStack() {
+	const size_t size = 256 * 1024;
+	volatile char stack[size];
+	for (size_t i = 0; i < size; i += 4096) {
+		stack[i] = 0;
+	}
+	// Read it back so the array counts as used
+	(void) stack[0];
+}
+
+/** Applies the real-time settings to the calling thread.
+`threadIndex` is 0 for the engine thread and counts up for workers.
+*/
+static void setupThread(int threadIndex) {
+	const EngineRealtimeSettings &settings = realtimeSettings;
+
+	if (settings.realtime) {
+#if ARCH_LIN || ARCH_MAC
+		sched_param param = {};
+		param.sched_priority = clamp(settings.priority, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err)
+			warn("Engine thread %d could not set SCHED_FIFO priority %d: %s", threadIndex, param.sched_priority, strerror(err));
+		else
+			info("Engine thread %d set SCHED_FIFO priority %d", threadIndex, param.sched_priority);
+#elif ARCH_WIN
+		if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+			info("Engine thread %d set time-critical priority", threadIndex);
+		else
+			warn("Engine thread %d could not set time-critical priority: error %lu", threadIndex, GetLastError());
+#endif
+	}
+
+	if (!settings.cpus.empty()) {
+		int cpu = settings.cpus[threadIndex % settings.cpus.size()];
+#if ARCH_LIN
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		CPU_SET(cpu, &cpuSet);
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+		if (err)
+			warn("Engine thread %d could not pin to CPU %d: %s", threadIndex, cpu, strerror(err));
+		else
+			info("Engine thread %d pinned to CPU %d", threadIndex, cpu);
+#elif ARCH_WIN
+		if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu))
+			info("Engine thread %d pinned to CPU %d", threadIndex, cpu);
+		else
+			warn("Engine thread %d could not pin to CPU %d: error %lu", threadIndex, cpu, GetLastError());
+#else
+		warn("Engine thread %d could not pin to CPU %d: not supported on this OS", threadIndex, cpu);
+#endif
+	}
+
+	if (memoryLocked) {
+		prefaultStack();
+	}
+}
+
+/** Locks current and future pages of the process into RAM. Stays in effect until the process exits. */
+static void lockMemory() {
+	if (memoryLocked)
+		return;
+#if ARCH_LIN || ARCH_MAC
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		warn("Could not lock memory: %s", strerror(errno));
+		return;
+	}
+	memoryLocked = true;
+	info("Locked memory");
+#else
+	warn("Could not lock memory: not supported on this OS");
+#endif
+}
+
+static void workerRun(int threadIndex) {
+	setupThread(threadIndex);
+	stepThreadIndex = threadIndex;
+	// Set CPU to flush-to-zero (FTZ) and denormals-are-zero (DAZ) mode
+	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
 
-			module->step();
+	while (true) {
+		workerStartBarrier.wait();
+		if (!workersRunning)
+			break;
+		stepModules();
+		workerEndBarrier.wait();
+	}
+}
 
-			auto stopTime = std::chrono::high_resolution_clock::now();
-			float cpuTime = std::chrono::duration<float>(stopTime - startTime).count() * sampleRate;
-			module->cpuTime += (cpuTime - module->cpuTime) * sampleTime / 0.5f;
+static void workersStart(int newThreadCount) {
+	threadCount = newThreadCount;
+	if (threadCount <= 1)
+		return;
+	workerStartBarrier.total = threadCount;
+	workerEndBarrier.total = threadCount;
+	workersRunning = true;
+	for (int i = 0; i < threadCount - 1; i++) {
+		workers.push_back(std::thread(workerRun, i + 1));
+	}
+}
+
+static void workersStop() {
+	if (threadCount > 1) {
+		// Wake up workers so they notice they should exit
+		workersRunning = false;
+		workerStartBarrier.wait();
+		for (std::thread &worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+	}
+	threadCount = 1;
+}
+
+/** Moves smoothing requests into the table of smoothed params */
+static void shiftSmoothQueue() {
+	bool recording = recorderIsRecording();
+	int64_t blockFrame = frameCounter.load(std::memory_order_relaxed);
+	SmoothParam request;
+	while (smoothQueue.shift(&request)) {
+		if (recording)
+			recorderParamSmooth(request.module, blockFrame, request.paramId, request.value, request.lambda);
+		int i;
+		for (i = 0; i < smoothParamsLen; i++) {
+			if (smoothParams[i].module == request.module && smoothParams[i].paramId == request.paramId)
+				break;
+		}
+		if (i < smoothParamsLen) {
+			// Retarget the param already being smoothed
+			smoothParams[i] = request;
+		}
+		else if (smoothParamsLen < smoothParamsSize) {
+			smoothParams[smoothParamsLen++] = request;
 		}
 		else {
-			module->step();
+			// The table is full, so jump to the value
+			request.module->params[request.paramId].value = request.value;
+			request.module->paramsChanged = true;
 		}
+	}
+}
 
-		// Step ports
-		for (Input &input : module->inputs) {
-			if (input.active) {
-				float value = input.value / 5.f;
-				input.plugLights[0].setBrightnessSmooth(value);
-				input.plugLights[1].setBrightnessSmooth(-value);
+/** Returns a hash of the block of every module output, which doesn't depend on the order of the modules */
+static uint64_t hashOutputs() {
+	uint64_t hash = 0;
+	for (Module *module : modules) {
+		// FNV-1a over the bits of each voltage
+		uint64_t moduleHash = 14695981039346656037ULL;
+		for (Output &output : module->outputs) {
+			for (int c = 0; c < output.channels; c++) {
+				const float *buffer = output.getBuffer(c);
+				for (int i = 0; i < blockSize; i++) {
+					uint32_t bits;
+					memcpy(&bits, &buffer[i], sizeof(bits));
+					moduleHash = (moduleHash ^ bits) * 1099511628211ULL;
+				}
 			}
 		}
+		hash += moduleHash;
+	}
+	return hash;
+}
+
+static void engineStep() {
+	// Profiling
+	bool profileBlock = gPowerMeter;
+	countChanges = profileBlock;
+	uint64_t blockStartCycles = 0;
+	if (profileResetRequested.exchange(false)) {
+		blockProfile.reset();
+		overruns = 0;
+		wireCopies = 0;
+		wireSkips = 0;
+		statelessSteps = 0;
+		statelessSkips = 0;
+		for (Module *module : modules) {
+			module->profile.reset();
+		}
+	}
+	profileModules = false;
+	if (profileBlock) {
+		blockStartCycles = profilerCycles();
+		if (++profileCounter >= profileDivision) {
+			profileCounter = 0;
+			profileModules = true;
+			profileSecondsPerCycle = 1.0 / profilerCyclesPerSecond();
+		}
+	}
+
+	// Events
+	collectEvents();
+
+	// Param smoothing
+	shiftSmoothQueue();
+	for (int i = 0; i < smoothParamsLen;) {
+		SmoothParam &smoothParam = smoothParams[i];
+		float &value = smoothParam.module->params[smoothParam.paramId].value;
+		float delta = smoothParam.value - value;
+		float newValue = value + delta * fminf(smoothParam.lambda * sampleTime * blockSize, 1.f);
+		smoothParam.module->paramsChanged = true;
+		if (value == newValue) {
+			// Snap to actual smooth value if the value doesn't change enough (due to the granularity of floats)
+			value = smoothParam.value;
+			// Remove by moving the last param into this slot
+			smoothParams[i] = smoothParams[--smoothParamsLen];
+		}
+		else {
+			value = newValue;
+			i++;
+		}
+	}
+
+	portLightsCounter += blockSize;
+	if (portLightsCounter >= portLightsDivision) {
+		portLightsFrames = portLightsCounter;
+		portLightsCounter = 0;
+	}
+	else {
+		portLightsFrames = 0;
+	}
+
+	// Step modules
+	if (threadCount > 1) {
+		workerModuleIndex = 0;
+		workerStartBarrier.wait();
+		stepModules();
+		workerEndBarrier.wait();
+	}
+	else {
+		for (Module *module : runnableModules) {
+			stepModule(module);
+		}
+	}
+
+	// Step cables by moving their output blocks to inputs, skipping outputs which held the voltage their input already holds
+	size_t wiresLen = wireInputs.size();
+	const Output *const *outputs = wireOutputs.data();
+	Input *const *inputs = wireInputs.data();
+	uint16_t *steadyFrames = wireSteadyFrames.data();
+	size_t copies = 0;
+	for (size_t i = 0; i < wiresLen; i++) {
+		const Output &output = *outputs[i];
+		Input &input = *inputs[i];
+		bool changed = output.changed || steadyFrames[i] < blockSize || input.channels != wireChannels(output, input);
+		if (changed) {
+			stepWireChannels(output, input, blockSize);
+			// An unchanged output holds the voltage already steady in the frames past this block
+			steadyFrames[i] = output.changed ? 0 : std::max((int) steadyFrames[i], blockSize);
+			copies++;
+		}
+		input.changed = changed;
+	}
+	if (countChanges) {
+		wireCopies += copies;
+		wireSkips += wiresLen - copies;
+	}
+
+	if (profileBlock) {
+		uint64_t blockCycles = profilerCycles() - blockStartCycles;
+		blockProfile.record(blockCycles / blockSize);
+		// Count blocks which took longer to step than they last in real time
+		if (blockCycles * profileSecondsPerCycle > blockSize * sampleTime)
+			overruns++;
+	}
+
+	if (recorderIsActive()) {
+		recorderBlock(frameCounter.load(std::memory_order_relaxed), blockSize, hashOutputs());
+	}
+
+	int64_t frame = frameCounter.fetch_add(blockSize, std::memory_order_relaxed) + blockSize;
+	frameOrigin.store(frame - getSteadyTime() * sampleRate, std::memory_order_relaxed);
+}
+
+/** Applies due events without stepping, so senders don't wait on a paused or stalled engine.
+Smoothed params jump to their targets, which also keeps engineSetParamSmooth() from waiting on a full queue.
+*/
+static void applyDueEvents() {
+	collectEvents();
+	for (int i = 0; i < blockEventsLen; i++) {
+		applyEvent(blockEvents[i]);
+	}
+	blockEventsLen = 0;
+
+	shiftSmoothQueue();
+	for (int i = 0; i < smoothParamsLen; i++) {
+		SmoothParam &smoothParam = smoothParams[i];
+		smoothParam.module->params[smoothParam.paramId].value = smoothParam.value;
+		smoothParam.module->paramsChanged = true;
+	}
+	smoothParamsLen = 0;
+}
+
+/** Removes element `i` of `v` by moving the last element into its place */
+template <typename T>
+static void swapRemove(std::vector<T> &v, size_t i) {
+	v[i] = v.back();
+	v.pop_back();
+}
+
+static bool isRunnable(Module *module) {
+	if (module->bypassed)
+		return false;
+	if (module->outputOnly) {
 		for (Output &output : module->outputs) {
-			if (output.active) {
-				float value = output.value / 5.f;
-				output.plugLights[0].setBrightnessSmooth(value);
-				output.plugLights[1].setBrightnessSmooth(-value);
+			if (output.active)
+				return true;
+		}
+		return false;
+	}
+	return true;
+}
+
+/** Adds or removes `module` from `runnableModules` if needed, or only removes it if `removed` is true */
+static void updateRunnable(Module *module, bool removed = false) {
+	bool runnable = !removed && isRunnable(module);
+	auto it = runnableIndex.find(module);
+	if (runnable && it == runnableIndex.end()) {
+		runnableIndex[module] = runnableModules.size();
+		runnableModules.push_back(module);
+	}
+	else if (!runnable && it != runnableIndex.end()) {
+		size_t i = it->second;
+		runnableIndex.erase(it);
+		swapRemove(runnableModules, i);
+		if (i < runnableModules.size())
+			runnableIndex[runnableModules[i]] = i;
+		// Don't leave a stale reading on the power meter
+		module->cpuTime = 0.f;
+	}
+}
+
+static void addWire(const Wire &wire) {
+	Output &output = wire.outputModule->outputs[wire.outputId];
+	Input &input = wire.inputModule->inputs[wire.inputId];
+	wireIndex[&input] = wires.size();
+	wires.push_back(wire);
+	wireOutputs.push_back(&output);
+	wireInputs.push_back(&input);
+	wireSteadyFrames.push_back(0);
+
+	input.active = true;
+	input.changed = true;
+	if (outputWireCounts[&output]++ == 0) {
+		output.active = true;
+		updateRunnable(wire.outputModule);
+	}
+}
+
+static void removeWire(const Wire &wire) {
+	Output &output = wire.outputModule->outputs[wire.outputId];
+	Input &input = wire.inputModule->inputs[wire.inputId];
+	// Inputs accept at most one wire, so the input identifies the wire
+	auto it = wireIndex.find(&input);
+	assert(it != wireIndex.end());
+	size_t i = it->second;
+	wireIndex.erase(it);
+	swapRemove(wires, i);
+	swapRemove(wireOutputs, i);
+	swapRemove(wireInputs, i);
+	swapRemove(wireSteadyFrames, i);
+	if (i < wires.size())
+		wireIndex[wireInputs[i]] = i;
+
+	// Set input to 0V
+	input.active = false;
+	input.channels = 0;
+	memset(input.voltages, 0, sizeof(input.voltages));
+	memset(input.buffer, 0, sizeof(float) * ENGINE_MAX_BLOCK_SIZE * input.maxChannels);
+	input.changed = true;
+
+	auto countIt = outputWireCounts.find(&output);
+	assert(countIt != outputWireCounts.end());
+	if (--countIt->second == 0) {
+		outputWireCounts.erase(countIt);
+		output.active = false;
+		updateRunnable(wire.outputModule);
+	}
+}
+
+/** Applies an edit to the engine's copy of the patch */
+static void applyCommand(const EngineCommand &command) {
+	switch (command.type) {
+		case EngineCommand::ADD_MODULE: {
+			Module *module = command.module;
+			moduleIndex[module] = modules.size();
+			modules.push_back(module);
+			updateRunnable(module);
+		} break;
+		case EngineCommand::REMOVE_MODULE: {
+			Module *module = command.module;
+			// If a param is being smoothed or an event is pending on this module, forget about it
+			// Smoothing requests and events sent before this command are already in their queues.
+			shiftSmoothQueue();
+			for (int i = 0; i < smoothParamsLen;) {
+				if (smoothParams[i].module == module)
+					smoothParams[i] = smoothParams[--smoothParamsLen];
+				else
+					i++;
 			}
+			shiftEventQueue();
+			for (int i = 0; i < pendingEventsLen;) {
+				if (pendingEvents[i].module == module)
+					pendingEvents[i] = pendingEvents[--pendingEventsLen];
+				else
+					i++;
+			}
+			updateRunnable(module, true);
+			auto it = moduleIndex.find(module);
+			assert(it != moduleIndex.end());
+			size_t i = it->second;
+			moduleIndex.erase(it);
+			swapRemove(modules, i);
+			if (i < modules.size())
+				moduleIndex[modules[i]] = i;
+		} break;
+		case EngineCommand::ADD_WIRE: {
+			addWire(command.wire);
+		} break;
+		case EngineCommand::REMOVE_WIRE: {
+			removeWire(command.wire);
+		} break;
+		case EngineCommand::SET_BYPASS: {
+			Module *module = command.module;
+			if (module->bypassed == command.bypassed)
+				break;
+			module->bypassed = command.bypassed;
+			if (module->bypassed) {
+				// Set outputs to 0V, and hold them unchanged from then on
+				for (Output &output : module->outputs) {
+					memset(output.voltages, 0, sizeof(output.voltages));
+					memset(output.buffer, 0, sizeof(float) * ENGINE_MAX_BLOCK_SIZE * output.maxChannels);
+					memset(output.lastVoltages, 0, sizeof(output.lastVoltages));
+					output.changed = false;
+				}
+				// Cables carry the zeroed blocks to their inputs on the next block, and are steady after that
+				for (size_t i = 0; i < wires.size(); i++) {
+					if (wires[i].outputModule == module)
+						wireSteadyFrames[i] = 0;
+				}
+			}
+			module->paramsChanged = true;
+			updateRunnable(module);
+		} break;
+		case EngineCommand::SET_OVERSAMPLE: {
+			Module *module = command.module;
+			module->oversample = command.oversample;
+			module->oversampler = command.oversampler;
+			stepOversample = module->oversample;
+			module->onSampleRateChange();
+			module->paramsChanged = true;
+			stepOversample = 1;
+		} break;
+	}
+}
+
+/** Applies all queued commands. Called by the engine thread between blocks, or by the UI thread when the engine thread is not running. */
+static void applyCommands() {
+	uint32_t start = commandQueueStart.load(std::memory_order_relaxed);
+	uint32_t end = commandQueueEnd.load(std::memory_order_acquire);
+	if (start == end)
+		return;
+
+	for (; start != end; start++) {
+		applyCommand(commandQueue[start % commandQueueSize]);
+	}
+	commandQueueStart.store(end, std::memory_order_release);
+}
+
+/** Sends an edit to the engine thread. If `sync` is true, waits until the engine thread has applied it. */
+static void pushCommand(const EngineCommand &command, bool sync) {
+	uint32_t end = commandQueueEnd.load(std::memory_order_relaxed);
+	// Wait for the engine thread to make room
+	while (end - commandQueueStart.load(std::memory_order_acquire) >= commandQueueSize) {
+		std::this_thread::yield();
+	}
+	commandQueue[end % commandQueueSize] = command;
+	end++;
+	commandQueueEnd.store(end, std::memory_order_release);
+
+	if (!running) {
+		// Nobody else will apply the command
+		applyCommands();
+	}
+	else if (sync) {
+		while (commandQueueStart.load(std::memory_order_acquire) != end) {
+			std::this_thread::yield();
 		}
 	}
+}
+
+/** Applies graph edits, thread count, and block size changes between blocks */
+static void applyRequests() {
+	applyCommands();
+
+	// Respawn worker threads if the thread count has changed
+	if (threadCountRequested != threadCount) {
+		workersStop();
+		workersStart(threadCountRequested);
+	}
 
-	// Step cables by moving their output values to inputs
-	for (Wire *wire : gWires) {
-		wire->step();
+	// Apply the requested block size between blocks
+	blockSize = blockSizeRequested;
+}
+
+static void stepLockAcquire() {
+	while (stepLock.test_and_set(std::memory_order_acquire)) {
+		std::this_thread::yield();
 	}
 }
 
+static void stepLockRelease() {
+	stepLock.clear(std::memory_order_release);
+}
+
 static void engineRun() {
+	setupThread(0);
 	// Set CPU to flush-to-zero (FTZ) and denormals-are-zero (DAZ) mode
 	// https://software.intel.com/en-us/node/682949
 	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
 	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
 
-	// Every time the engine waits and locks a mutex, it steps this many frames
+	// Every time the engine applies commands from the UI thread, it steps this many frames
 	const int mutexSteps = 64;
 	// Time in seconds that the engine is rushing ahead of the estimated clock time
 	double ahead = 0.0;
 	auto lastTime = std::chrono::high_resolution_clock::now();
 
+	stepLockAcquire();
+	workersStart(threadCountRequested);
+	stepLockRelease();
+
+	// Detects when the clock module's stream has stalled
+	int64_t clockFrame = -1;
+	int clockStalledCount = 0;
+
 	while (running) {
-		vipMutex.wait();
+		if (clockModule) {
+			// An audio device steps the engine from its callback.
+			// Only apply graph edits here, and events if its stream has stalled for 100 ms, so they still go through.
+			if (!stepLock.test_and_set(std::memory_order_acquire)) {
+				applyCommands();
+				int64_t frame = frameCounter.load(std::memory_order_relaxed);
+				if (frame != clockFrame) {
+					clockFrame = frame;
+					clockStalledCount = 0;
+				}
+				else if (++clockStalledCount >= 100) {
+					applyDueEvents();
+				}
+				stepLockRelease();
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			ahead = 0.0;
+			lastTime = std::chrono::high_resolution_clock::now();
+			continue;
+		}
+
+		stepLockAcquire();
+		applyRequests();
+		// Step at least one block
+		int blocks = max_rack(mutexSteps / blockSize, 1);
 
 		if (!gPaused) {
-			std::lock_guard<std::mutex> lock(mutex);
-			for (int i = 0; i < mutexSteps; i++) {
+			for (int i = 0; i < blocks; i++) {
 				engineStep();
 			}
 		}
+		else {
+			applyDueEvents();
+		}
+		double stepTime = blocks * blockSize * sampleTime;
+		stepLockRelease();
 
-		double stepTime = mutexSteps * sampleTime;
 		ahead += stepTime;
 		auto currTime = std::chrono::high_resolution_clock::now();
 		const double aheadFactor = 2.0;
@@ -188,9 +1427,17 @@ static void engineRun() {
 			std::this_thread::sleep_for(std::chrono::duration<double>(stepTime));
 		}
 	}
+
+	stepLockAcquire();
+	workersStop();
+	applyCommands();
+	stepLockRelease();
 }
 
 void engineStart() {
+	if (realtimeSettings.lockMemory) {
+		lockMemory();
+	}
 	running = true;
 	thread = std::thread(engineRun);
 }
@@ -200,116 +1447,375 @@ void engineStop() {
 	thread.join();
 }
 
+bool engineClockAcquire(Module *module) {
+	Module *owner = NULL;
+	return clockModule.compare_exchange_strong(owner, module) || owner == module;
+}
+
+void engineClockRelease(Module *module) {
+	Module *owner = module;
+	clockModule.compare_exchange_strong(owner, NULL);
+}
+
+Module *engineGetClockModule() {
+	return clockModule;
+}
+
+bool engineClockStep(Module *module, int frames) {
+	if (clockModule != module)
+		return false;
+	stepLockAcquire();
+	if (!running) {
+		stepLockRelease();
+		return false;
+	}
+	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+
+	int frame = 0;
+	while (frame < frames) {
+		applyRequests();
+		// Shorten the last block so exactly `frames` frames are stepped
+		blockSize = std::min(blockSize, frames - frame);
+		if (!gPaused) {
+			engineStep();
+		}
+		else {
+			applyDueEvents();
+		}
+		frame += blockSize;
+	}
+	stepLockRelease();
+	return true;
+}
+
+void engineRenderStart() {
+	assert(!running);
+	rendering = true;
+	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+	workersStart(threadCountRequested);
+}
+
+int engineRenderBlock() {
+	applyRequests();
+	engineStep();
+	return blockSize;
+}
+
+void engineRenderStop() {
+	workersStop();
+	applyCommands();
+	rendering = false;
+}
+
+/** Ends the recording before the patch is edited, since edits are not recorded */
+static void stopRecording() {
+	if (recorderIsRecording()) {
+		warn("Patch edited, stopping recording");
+		recorderStop();
+	}
+}
+
 void engineAddModule(Module *module) {
 	assert(module);
-	VIPLock vipLock(vipMutex);
-	std::lock_guard<std::mutex> lock(mutex);
+	stopRecording();
 	// Check that the module is not already added
-	auto it = std::find(gModules.begin(), gModules.end(), module);
-	assert(it == gModules.end());
+	assert(uiModuleIndex.find(module) == uiModuleIndex.end());
+	// Allocate a block buffer for each channel each port declares
+	int channels = 0;
+	for (Input &input : module->inputs) {
+		input.maxChannels = clamp(input.maxChannels, 1, PORT_MAX_CHANNELS);
+		channels += input.maxChannels;
+	}
+	for (Output &output : module->outputs) {
+		output.maxChannels = clamp(output.maxChannels, 1, PORT_MAX_CHANNELS);
+		output.channels = std::min(output.channels, output.maxChannels);
+		channels += output.maxChannels;
+	}
+	module->portBuffers.assign(channels * ENGINE_MAX_BLOCK_SIZE, 0.f);
+	float *portBuffer = module->portBuffers.data();
+	for (Input &input : module->inputs) {
+		input.buffer = portBuffer;
+		portBuffer += ENGINE_MAX_BLOCK_SIZE * input.maxChannels;
+	}
+	for (Output &output : module->outputs) {
+		output.buffer = portBuffer;
+		portBuffer += ENGINE_MAX_BLOCK_SIZE * output.maxChannels;
+	}
+	uiModuleIndex[module] = gModules.size();
 	gModules.push_back(module);
+
+	EngineCommand command;
+	command.type = EngineCommand::ADD_MODULE;
+	command.module = module;
+	pushCommand(command, false);
 }
 
 void engineRemoveModule(Module *module) {
 	assert(module);
-	VIPLock vipLock(vipMutex);
-	std::lock_guard<std::mutex> lock(mutex);
-	// If a param is being smoothed on this module, stop smoothing it immediately
-	if (module == smoothModule) {
-		smoothModule = NULL;
-	}
+	stopRecording();
 	// Check that all wires are disconnected
-	for (Wire *wire : gWires) {
-		assert(wire->outputModule != module);
-		assert(wire->inputModule != module);
-	}
+	assert(uiModuleWireCounts.find(module) == uiModuleWireCounts.end());
 	// Check that the module actually exists
-	auto it = std::find(gModules.begin(), gModules.end(), module);
-	assert(it != gModules.end());
+	auto it = uiModuleIndex.find(module);
+	assert(it != uiModuleIndex.end());
 	// Remove it
-	gModules.erase(it);
+	size_t i = it->second;
+	uiModuleIndex.erase(it);
+	swapRemove(gModules, i);
+	if (i < gModules.size())
+		uiModuleIndex[gModules[i]] = i;
+
+	// The caller usually deletes the module next, so wait until the engine thread is done with it
+	EngineCommand command;
+	command.type = EngineCommand::REMOVE_MODULE;
+	command.module = module;
+	pushCommand(command, true);
+
+	delete module->oversampler;
+	module->oversampler = NULL;
+}
+
+/** Sends an event to the engine thread, or applies it immediately if the engine thread is not running */
+static void pushEvent(const EngineEvent &event) {
+	while (running) {
+		if (eventQueue.push(event))
+			return;
+		// Wait for the engine thread to make room
+		std::this_thread::yield();
+	}
+	// While rendering, the calling thread steps the engine, so it can't wait for room
+	if (rendering && eventQueue.push(event))
+		return;
+	applyEvent(event);
 }
 
 void engineResetModule(Module *module) {
-	resetModule = module;
+	EngineEvent event;
+	event.type = EngineEvent::RESET;
+	event.module = module;
+	event.frame = 0;
+	pushEvent(event);
 }
 
 void engineRandomizeModule(Module *module) {
-	randomizeModule = module;
+	EngineEvent event;
+	event.type = EngineEvent::RANDOMIZE;
+	event.module = module;
+	event.frame = 0;
+	pushEvent(event);
 }
 
-static void updateActive() {
-	// Set everything to inactive
-	for (Module *module : gModules) {
-		for (Input &input : module->inputs) {
-			input.active = false;
-		}
-		for (Output &output : module->outputs) {
-			output.active = false;
-		}
-	}
-	// Set inputs/outputs to active
-	for (Wire *wire : gWires) {
-		wire->outputModule->outputs[wire->outputId].active = true;
-		wire->inputModule->inputs[wire->inputId].active = true;
-	}
+void engineSendMidiMessage(Module *module, MidiMessage message, int64_t frame) {
+	EngineEvent event;
+	event.type = EngineEvent::MIDI_MESSAGE;
+	event.module = module;
+	event.message = message;
+	event.frame = frame;
+	pushEvent(event);
+}
+
+void engineSetModuleBypass(Module *module, bool bypassed) {
+	if (module->bypassed == bypassed)
+		return;
+	stopRecording();
+
+	EngineCommand command;
+	command.type = EngineCommand::SET_BYPASS;
+	command.module = module;
+	command.bypassed = bypassed;
+	// Wait for the engine thread to set the flag, so the next call compares against it
+	pushCommand(command, true);
+}
+
+void engineSetModuleOversample(Module *module, int oversample) {
+	if (!(oversample == 2 || oversample == 4 || oversample == 8))
+		oversample = 1;
+	if (module->oversample == oversample)
+		return;
+	stopRecording();
+
+	EngineCommand command;
+	command.type = EngineCommand::SET_OVERSAMPLE;
+	command.module = module;
+	command.oversample = oversample;
+	// Allocate the new state here, and free the old state once the engine thread has let go of it, so the engine thread does not have to
+	command.oversampler = createOversampler(module, oversample);
+	ModuleOversampler *oldOversampler = module->oversampler;
+	pushCommand(command, true);
+	delete oldOversampler;
 }
 
 void engineAddWire(Wire *wire) {
 	assert(wire);
-	VIPLock vipLock(vipMutex);
-	std::lock_guard<std::mutex> lock(mutex);
+	stopRecording();
 	// Check wire properties
 	assert(wire->outputModule);
 	assert(wire->inputModule);
 	// Check that the wire is not already added, and that the input is not already used by another cable
-	for (Wire *wire2 : gWires) {
-		assert(wire2 != wire);
-		assert(!(wire2->inputModule == wire->inputModule && wire2->inputId == wire->inputId));
-	}
+	assert(uiWireIndex.find(wire) == uiWireIndex.end());
+	bool inputFree = uiPluggedInputs.insert(&wire->inputModule->inputs[wire->inputId]).second;
+	assert(inputFree);
+	(void) inputFree;
 	// Add the wire
+	uiWireIndex[wire] = gWires.size();
 	gWires.push_back(wire);
-	updateActive();
+	uiModuleWireCounts[wire->outputModule]++;
+	uiModuleWireCounts[wire->inputModule]++;
+
+	EngineCommand command;
+	command.type = EngineCommand::ADD_WIRE;
+	command.wire = *wire;
+	pushCommand(command, false);
 }
 
 void engineRemoveWire(Wire *wire) {
 	assert(wire);
-	VIPLock vipLock(vipMutex);
-	std::lock_guard<std::mutex> lock(mutex);
+	stopRecording();
 	// Check that the wire is already added
-	auto it = std::find(gWires.begin(), gWires.end(), wire);
-	assert(it != gWires.end());
-	// Set input to 0V
-	wire->inputModule->inputs[wire->inputId].value = 0.0;
+	auto it = uiWireIndex.find(wire);
+	assert(it != uiWireIndex.end());
 	// Remove the wire
-	gWires.erase(it);
-	updateActive();
+	size_t i = it->second;
+	uiWireIndex.erase(it);
+	swapRemove(gWires, i);
+	if (i < gWires.size())
+		uiWireIndex[gWires[i]] = i;
+	uiPluggedInputs.erase(&wire->inputModule->inputs[wire->inputId]);
+	for (Module *module : {wire->outputModule, wire->inputModule}) {
+		if (--uiModuleWireCounts[module] == 0)
+			uiModuleWireCounts.erase(module);
+	}
+
+	EngineCommand command;
+	command.type = EngineCommand::REMOVE_WIRE;
+	command.wire = *wire;
+	pushCommand(command, false);
 }
 
-void engineSetParam(Module *module, int paramId, float value) {
-	module->params[paramId].value = value;
+void engineSetParam(Module *module, int paramId, float value, int64_t frame) {
+	EngineEvent event;
+	event.type = EngineEvent::SET_PARAM;
+	event.module = module;
+	event.paramId = paramId;
+	event.value = value;
+	event.frame = frame;
+	pushEvent(event);
 }
 
-void engineSetParamSmooth(Module *module, int paramId, float value) {
-	// If another param is being smoothed, jump value
-	if (smoothModule && !(smoothModule == module && smoothParamId == paramId)) {
-		smoothModule->params[smoothParamId].value = smoothValue;
+void engineSetParamSmooth(Module *module, int paramId, float value, float lambda) {
+	SmoothParam request;
+	request.module = module;
+	request.paramId = paramId;
+	request.value = value;
+	request.lambda = lambda;
+	while (running) {
+		if (smoothQueue.push(request))
+			return;
+		// Wait for the engine thread to make room
+		std::this_thread::yield();
 	}
-	smoothParamId = paramId;
-	smoothValue = value;
-	smoothModule = module;
+	if (rendering && smoothQueue.push(request))
+		return;
+	// Nothing is smoothing, or the rendering thread can't make room, so jump to the value through an event, which marks the params changed
+	engineSetParam(module, paramId, value);
 }
 
 void engineSetSampleRate(float newSampleRate) {
-	sampleRateRequested = newSampleRate;
+	EngineEvent event;
+	event.type = EngineEvent::SAMPLE_RATE;
+	event.module = NULL;
+	event.value = newSampleRate;
+	event.frame = 0;
+	pushEvent(event);
+}
+
+void engineSetThreadCount(int newThreadCount) {
+	threadCountRequested = max_rack(newThreadCount, 1);
+}
+
+int engineGetThreadCount() {
+	return threadCountRequested;
+}
+
+int engineGetMaxThreadCount() {
+	return max_rack((int) std::thread::hardware_concurrency(), 1);
+}
+
+void engineSetBlockSize(int newBlockSize) {
+	blockSizeRequested = clamp(newBlockSize, 1, ENGINE_MAX_BLOCK_SIZE);
+}
+
+int engineGetBlockSize() {
+	return blockSizeRequested;
+}
+
+const ProfilerHistogram &engineGetBlockProfile() {
+	return blockProfile;
+}
+
+int engineGetOverruns() {
+	return overruns;
+}
+
+void engineResetProfile() {
+	profileResetRequested = true;
+}
+
+EngineChangeCounts engineGetChangeCounts() {
+	EngineChangeCounts counts;
+	counts.wireCopies = wireCopies;
+	counts.wireSkips = wireSkips;
+	counts.statelessSteps = statelessSteps;
+	counts.statelessSkips = statelessSkips;
+	return counts;
+}
+
+void engineSetRealtimeSettings(const EngineRealtimeSettings &settings) {
+	realtimeSettings = settings;
+}
+
+const EngineRealtimeSettings &engineGetRealtimeSettings() {
+	return realtimeSettings;
+}
+
+int engineGetMaxCpus() {
+#if ARCH_LIN
+	return CPU_SETSIZE;
+#elif ARCH_WIN
+	return sizeof(DWORD_PTR) * 8;
+#else
+	return 0;
+#endif
+}
+
+int64_t engineGetFrame() {
+	return frameCounter.load(std::memory_order_relaxed);
+}
+
+Module *engineGetSteppingModule() {
+	return steppingModule;
+}
+
+int64_t engineGetStepFrame() {
+	return stepFrame;
+}
+
+int64_t engineGetDeviceFrame() {
+	return (int64_t) (frameOrigin.load(std::memory_order_relaxed) + getSteadyTime() * sampleRate) + blockSize;
+}
+
+int engineGetThreadIndex() {
+	return stepThreadIndex;
 }
 
 float engineGetSampleRate() {
-	return sampleRate;
+	return sampleRate * stepOversample;
 }
 
 float engineGetSampleTime() {
-	return sampleTime;
+	return sampleTime / stepOversample;
 }
 
 } // namespace rack
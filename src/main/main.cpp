@@ -10,6 +10,7 @@
 #include "rtmidi.hpp"
 #include "keyboard.hpp"
 #include "gamepad.hpp"
+#include "recorder.hpp"
 #include "util/color.hpp"
 
 #include "osdialog.h"
@@ -27,15 +28,123 @@ using namespace rack;
 //extern char* optarg;
 //extern int getopt(int argc, char* const argv[], const char* optstring);
 #include "../getopt.h"
+#include "../../wdl/wavwrite.h"
+#include <chrono>
+
+
+/** Returns the first Core Audio or Audio-64 module in the rack, whose inputs are rendered to disk */
+static ModuleWidget *findAudioInterface() {
+	for (Widget *w : gRackWidget->moduleContainer->children) {
+		ModuleWidget *moduleWidget = dynamic_cast<ModuleWidget*>(w);
+		assert(moduleWidget);
+		Model *model = moduleWidget->model;
+		if (model->plugin->slug == "Core" && (model->slug == "AudioInterface" || model->slug == "AudioInterface64"))
+			return moduleWidget;
+	}
+	return NULL;
+}
+
+/** Steps the engine as fast as possible for `frames` frames, writing the inputs of the patch's AudioInterface to a 24 bit WAV file.
+While replaying a recording, feeds it to the engine before each block, and the WAV file is optional.
+Saves the engine and module profiles to `profileFile` if given. Returns the exit code.
+*/
+static int renderPatch(std::string outputFile, long frames, int sampleRate, std::string profileFile) {
+	ModuleWidget *audioWidget = findAudioInterface();
+	if (!audioWidget && !outputFile.empty()) {
+		warn("Patch has no Audio module to render");
+		return 1;
+	}
+	Module *audioModule = audioWidget ? audioWidget->module : NULL;
+	// Close the audio device opened by the patch, so the Audio module doesn't wait on it.
+	// Reach its AudioIO through the module's AudioWidget, rather than resetting the module.
+	if (audioWidget) {
+		for (Widget *w : audioWidget->children) {
+			AudioWidget *deviceWidget = dynamic_cast<AudioWidget*>(w);
+			if (deviceWidget && deviceWidget->audioIO)
+				deviceWidget->audioIO->setDevice(-1, 0);
+		}
+	}
+
+	WaveWriter wav;
+	int channels = 0;
+	if (!outputFile.empty()) {
+		// Write up to the last patched input, with at least 2 channels
+		channels = 2;
+		for (int i = 0; i < (int) audioModule->inputs.size(); i++) {
+			if (audioModule->inputs[i].active)
+				channels = max_rack(channels, i + 1);
+		}
+		if (!wav.Open(outputFile.c_str(), 24, channels, sampleRate, 0)) {
+			warn("Could not open %s for writing", outputFile.c_str());
+			return 1;
+		}
+		info("Rendering %ld frames of %d channels at %d Hz to %s", frames, channels, sampleRate, outputFile.c_str());
+	}
+
+	gPowerMeter = true;
+	std::vector<float> samples(ENGINE_MAX_BLOCK_SIZE * channels);
+	auto startTime = std::chrono::high_resolution_clock::now();
+	engineRenderStart();
+	long frame = 0;
+	while (frame < frames) {
+		recorderReplayBlock();
+		int blockFrames = engineRenderBlock();
+		blockFrames = std::min((long) blockFrames, frames - frame);
+		if (channels > 0) {
+			// Interleave the block and convert from Rack voltage to audio level, like the Audio module does
+			for (int i = 0; i < blockFrames; i++) {
+				for (int c = 0; c < channels; c++) {
+					samples[i * channels + c] = clamp(audioModule->inputs[c].buffer[i] / 10.f, -1.f, 1.f);
+				}
+			}
+			wav.WriteFloats(samples.data(), blockFrames * channels);
+		}
+		frame += blockFrames;
+	}
+	engineRenderStop();
+	auto endTime = std::chrono::high_resolution_clock::now();
+
+	// Report performance
+	double duration = std::chrono::duration<double>(endTime - startTime).count();
+	double renderDuration = frames / (double) sampleRate;
+	info("Rendered %f seconds in %f seconds, real-time factor %f", renderDuration, duration, renderDuration / fmax(duration, 1e-9));
+	// Convert cycles per frame to percent of real time
+	double cpuFactor = 100.0 / profilerCyclesPerSecond() * sampleRate;
+	const ProfilerHistogram &blockProfile = engineGetBlockProfile();
+	info("Engine CPU p50 %f%% p99 %f%% max %f%%, %d overruns", blockProfile.percentile(0.5f) * cpuFactor, blockProfile.percentile(0.99f) * cpuFactor, blockProfile.max * cpuFactor, engineGetOverruns());
+	EngineChangeCounts changeCounts = engineGetChangeCounts();
+	info("Cable blocks copied %llu skipped %llu, stateless module blocks stepped %llu skipped %llu", (unsigned long long) changeCounts.wireCopies, (unsigned long long) changeCounts.wireSkips, (unsigned long long) changeCounts.statelessSteps, (unsigned long long) changeCounts.statelessSkips);
+	for (Widget *w : gRackWidget->moduleContainer->children) {
+		ModuleWidget *moduleWidget = dynamic_cast<ModuleWidget*>(w);
+		const ProfilerHistogram &profile = moduleWidget->module->profile;
+		info("CPU %f%% p50 %f%% p99 %f%% %s %s", moduleWidget->module->cpuTime * 100.f, profile.percentile(0.5f) * cpuFactor, profile.percentile(0.99f) * cpuFactor, moduleWidget->model->plugin->slug.c_str(), moduleWidget->model->slug.c_str());
+	}
+	if (!profileFile.empty())
+		profilerSave(profileFile);
+	gPowerMeter = false;
+
+	// Fail if a replay's output differs, so the replay can drive a bisection
+	if (recorderIsReplaying() && !recorderReplayStop())
+		return 1;
+	return 0;
+}
+
 
 int main(int argc, char* argv[]) {
 	bool devMode = false;
 	std::string patchFile;
+	// Offline rendering
+	std::string renderFile;
+	std::string replayFile;
+	std::string profileFile;
+	double renderDuration = 10.0;
+	long renderFrames = -1;
+	float renderSampleRate = 44100.f;
 
 	// Parse command line arguments
 	int c;
 	opterr = 0;
-	while ((c = getopt(argc, argv, ":dg:l:")) != -1) {
+	while ((c = getopt(argc, argv, ":dg:l:o:t:n:r:i:p:")) != -1) {
 		switch (c) {
 			case 'd': {
 				devMode = true;
@@ -46,12 +155,78 @@ int main(int argc, char* argv[]) {
 			case 'l': {
 				assetLocalDir = optarg;
 			} break;
+			case 'o': {
+				renderFile = optarg;
+			} break;
+			case 't': {
+				renderDuration = atof(optarg);
+			} break;
+			case 'n': {
+				renderFrames = atol(optarg);
+			} break;
+			case 'r': {
+				renderSampleRate = atof(optarg);
+			} break;
+			case 'i': {
+				replayFile = optarg;
+			} break;
+			case 'p': {
+				profileFile = optarg;
+			} break;
 			default: break;
 		}
 	}
 	if (optind < argc) {
 		patchFile = argv[optind];
 	}
+
+	if (!renderFile.empty() || !replayFile.empty()) {
+		// Render the patch offline without a window, audio device, or settings
+		if (patchFile.empty() && replayFile.empty()) {
+			fprintf(stderr, "Usage: Rack -o output.wav [-t seconds | -n frames] [-r sample rate] [-p profile.json] patch.vcv\n");
+			fprintf(stderr, "       Rack -i recording.rec [-o output.wav] [-n frames] [-p profile.json]\n");
+			return 1;
+		}
+		randomInit();
+		assetInit(devMode);
+		loggerInit(devMode);
+		pluginInit(devMode);
+		engineInit();
+		rtmidiInit();
+		bridgeInit();
+		keyboardInit();
+		appInit(devMode);
+
+		int status = 0;
+		if (!replayFile.empty()) {
+			// Replay a recording against the patch it holds, at its sample rate
+			if (recorderReplayStart(replayFile)) {
+				renderSampleRate = engineGetSampleRate();
+				if (renderFrames < 0)
+					renderFrames = recorderGetReplayFrames();
+			}
+			else {
+				status = 1;
+			}
+		}
+		else {
+			engineSetSampleRate(renderSampleRate);
+			if (renderFrames < 0)
+				renderFrames = (long) (renderDuration * renderSampleRate);
+			gRackWidget->load(patchFile);
+		}
+		if (status == 0)
+			status = renderPatch(renderFile, renderFrames, (int) renderSampleRate, profileFile);
+
+		appDestroy();
+		bridgeDestroy();
+		engineDestroy();
+		midiDestroy();
+		pluginDestroy();
+		loggerDestroy();
+		return status;
+	}
+
 #ifdef ARCH_WIN
 	// Windows global mutex to prevent multiple instances
 	// Handle will be closed by Windows when the process ends
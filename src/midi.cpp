@@ -3,6 +3,7 @@
 #include "bridge.hpp"
 #include "gamepad.hpp"
 #include "keyboard.hpp"
+#include "recorder.hpp"
 
 
 namespace rack {
@@ -163,6 +164,14 @@ void MidiInputQueue::onMessage(MidiMessage message) {
 			return;
 	}
 
+	if (module) {
+		// Messages come from the recording instead of the device
+		if (recorderIsReplaying())
+			return;
+		engineSendMidiMessage(module, message, engineGetDeviceFrame());
+		return;
+	}
+
 	// Push to queue
 	if ((int) queue.size() < queueMaxSize)
 		queue.push(message);
@@ -171,9 +180,15 @@ void MidiInputQueue::onMessage(MidiMessage message) {
 bool MidiInputQueue::shift(MidiMessage *message) {
 	if (!message)
 		return false;
+	if (recorderIsReplaying()) {
+		// Messages come from the recording instead of the device
+		return recorderReplayMidiInput(message);
+	}
 	if (!queue.empty()) {
 		*message = queue.front();
 		queue.pop();
+		if (recorderIsRecording())
+			recorderMidiInput(*message);
 		return true;
 	}
 	return false;
@@ -0,0 +1,130 @@
+#include "profiler.hpp"
+#include "engine.hpp"
+#include "app.hpp"
+#include "plugin.hpp"
+#include "audio.hpp"
+#include <math.h>
+#include <chrono>
+
+
+namespace rack {
+
+
+static const uint64_t startCycles = profilerCycles();
+static const auto startTime = std::chrono::steady_clock::now();
+
+
+double profilerCyclesPerSecond() {
+	uint64_t cycles = profilerCycles() - startCycles;
+	double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	if (cycles == 0 || duration <= 0.0)
+		return 1e9;
+	return cycles / duration;
+}
+
+
+static int binIndex(uint64_t cycles) {
+	if (cycles < 4)
+		return cycles;
+	int octave = ilogb((double) cycles);
+	int sub = (cycles >> (octave - 2)) & 3;
+	return std::min(4 * (octave - 1) + sub, ProfilerHistogram::BINS - 1);
+}
+
+/** Returns the largest cycle count in bin `i` */
+static uint64_t binEdge(int i) {
+	if (i < 4)
+		return i;
+	int shift = i / 4 - 1;
+	uint64_t lower = (uint64_t) (4 + i % 4) << shift;
+	return lower + ((uint64_t) 1 << shift) - 1;
+}
+
+void ProfilerHistogram::record(uint64_t cycles) {
+	bins[binIndex(cycles)]++;
+	count++;
+	if (cycles > max)
+		max = cycles;
+}
+
+uint64_t ProfilerHistogram::percentile(float p) const {
+	uint32_t target = ceilf(p * count);
+	uint32_t total = 0;
+	for (int i = 0; i < BINS; i++) {
+		total += bins[i];
+		if (total >= target && total > 0)
+			return std::min(binEdge(i), max);
+	}
+	return max;
+}
+
+void ProfilerHistogram::reset() {
+	for (int i = 0; i < BINS; i++) {
+		bins[i] = 0;
+	}
+	count = 0;
+	max = 0;
+}
+
+json_t *ProfilerHistogram::toJson(double secondsPerCycle) const {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, "count", json_integer(count));
+	json_object_set_new(rootJ, "p50", json_real(percentile(0.5f) * secondsPerCycle));
+	json_object_set_new(rootJ, "p99", json_real(percentile(0.99f) * secondsPerCycle));
+	json_object_set_new(rootJ, "max", json_real(max * secondsPerCycle));
+	return rootJ;
+}
+
+
+void profilerSave(std::string filename) {
+	info("Saving profile %s", filename.c_str());
+	double secondsPerCycle = 1.0 / profilerCyclesPerSecond();
+
+	// root
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, "sampleRate", json_real(engineGetSampleRate()));
+	json_object_set_new(rootJ, "blockSize", json_integer(engineGetBlockSize()));
+	json_object_set_new(rootJ, "threadCount", json_integer(engineGetThreadCount()));
+	json_object_set_new(rootJ, "overruns", json_integer(engineGetOverruns()));
+	// Times are in seconds per frame
+	json_object_set_new(rootJ, "block", engineGetBlockProfile().toJson(secondsPerCycle));
+	// Work avoided because signals didn't change
+	EngineChangeCounts changeCounts = engineGetChangeCounts();
+	json_t *changesJ = json_object();
+	json_object_set_new(changesJ, "wireCopies", json_integer(changeCounts.wireCopies));
+	json_object_set_new(changesJ, "wireSkips", json_integer(changeCounts.wireSkips));
+	json_object_set_new(changesJ, "statelessSteps", json_integer(changeCounts.statelessSteps));
+	json_object_set_new(changesJ, "statelessSkips", json_integer(changeCounts.statelessSkips));
+	json_object_set_new(rootJ, "changes", changesJ);
+	// Telemetry of the open audio streams
+	json_object_set_new(rootJ, "audio", audioGetStatsJson());
+
+	// modules
+	json_t *modulesJ = json_array();
+	for (Widget *w : gRackWidget->moduleContainer->children) {
+		ModuleWidget *moduleWidget = dynamic_cast<ModuleWidget*>(w);
+		assert(moduleWidget);
+		if (!moduleWidget->module)
+			continue;
+		json_t *moduleJ = moduleWidget->module->profile.toJson(secondsPerCycle);
+		json_object_set_new(moduleJ, "plugin", json_string(moduleWidget->model->plugin->slug.c_str()));
+		json_object_set_new(moduleJ, "model", json_string(moduleWidget->model->slug.c_str()));
+		json_object_set_new(moduleJ, "cpuTime", json_real(moduleWidget->module->cpuTime));
+		json_array_append_new(modulesJ, moduleJ);
+	}
+	json_object_set_new(rootJ, "modules", modulesJ);
+
+	FILE *file = fopen(filename.c_str(), "w");
+	if (file) {
+		json_dumpf(rootJ, file, JSON_INDENT(2) | JSON_REAL_PRECISION(9));
+		fclose(file);
+	}
+	else {
+		warn("Could not open profile %s for writing", filename.c_str());
+	}
+
+	json_decref(rootJ);
+}
+
+
+} // namespace rack
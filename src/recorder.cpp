@@ -0,0 +1,765 @@
+#include "recorder.hpp"
+#include "app.hpp"
+#include "dsp/ringbuffer.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+
+namespace rack {
+
+
+enum RecordType {
+	RECORD_END,
+	RECORD_PARAM,
+	RECORD_PARAM_SMOOTH,
+	RECORD_RESET,
+	RECORD_RANDOMIZE,
+	RECORD_MIDI_MESSAGE,
+	RECORD_SAMPLE_RATE,
+	RECORD_BLOCK_SIZE,
+	RECORD_MIDI_INPUT,
+	RECORD_AUDIO_INPUT,
+	RECORD_HASH,
+};
+
+static const char RECORDING_MAGIC[8] = {'R', 'A', 'C', 'K', 'R', 'E', 'C', '\0'};
+static const uint32_t RECORDING_VERSION = 2;
+/** Number of frames covered by each output hash */
+static const int HASH_FRAMES = 4096;
+static const uint64_t HASH_OFFSET = 14695981039346656037ULL;
+static const uint64_t HASH_PRIME = 1099511628211ULL;
+/** Bytes of records each engine thread can hold between writes, several times what the writer thread drains each time */
+static const size_t RECORD_RING_SIZE = 1 << 20;
+/** Device input channels of a frame, enough for the Audio-64 module */
+static const int RECORD_AUDIO_MAX_CHANNELS = 64;
+
+
+/** Encodes a record into a fixed buffer.
+Integers are little-endian base-128 varints, so frames and IDs take a few bytes. Floats are stored as their bits.
+*/
+struct RecordWriter {
+	// The type, frame, module ID and channel count take at most 17 bytes
+	uint8_t data[24 + 4 * RECORD_AUDIO_MAX_CHANNELS];
+	int len = 0;
+
+	void u8(uint8_t x) {
+		data[len++] = x;
+	}
+	void varint(uint64_t x) {
+		while (x >= 0x80) {
+			data[len++] = (x & 0x7f) | 0x80;
+			x >>= 7;
+		}
+		data[len++] = x;
+	}
+	void u64(uint64_t x) {
+		memcpy(&data[len], &x, sizeof(x));
+		len += sizeof(x);
+	}
+	void f32(float x) {
+		memcpy(&data[len], &x, sizeof(x));
+		len += sizeof(x);
+	}
+};
+
+/** Decodes records, flagging an error rather than reading past the end */
+struct RecordReader {
+	const uint8_t *data;
+	size_t size;
+	size_t pos = 0;
+	bool error = false;
+
+	RecordReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+	bool has(size_t n) {
+		if (pos + n > size)
+			error = true;
+		return !error;
+	}
+	uint8_t u8() {
+		if (!has(1))
+			return 0;
+		return data[pos++];
+	}
+	uint64_t varint() {
+		uint64_t x = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			uint8_t b = u8();
+			x |= (uint64_t) (b & 0x7f) << shift;
+			if (!(b & 0x80))
+				break;
+		}
+		return x;
+	}
+	uint32_t u32() {
+		uint32_t x = 0;
+		if (has(sizeof(x))) {
+			memcpy(&x, &data[pos], sizeof(x));
+			pos += sizeof(x);
+		}
+		return x;
+	}
+	uint64_t u64() {
+		uint64_t x = 0;
+		if (has(sizeof(x))) {
+			memcpy(&x, &data[pos], sizeof(x));
+			pos += sizeof(x);
+		}
+		return x;
+	}
+	float f32() {
+		float x = 0.f;
+		if (has(sizeof(x))) {
+			memcpy(&x, &data[pos], sizeof(x));
+			pos += sizeof(x);
+		}
+		return x;
+	}
+};
+
+
+// Recording
+
+static std::atomic<bool> recording(false);
+/** Records from each engine thread, indexed by engineGetThreadIndex(), so threads append without locks or allocation.
+Allocated when recording starts, and never freed, so late appends from stepping threads stay in bounds.
+*/
+static std::vector<SPSCRingBuffer<uint8_t>*> recordRings;
+/** Set when a record was dropped because its thread's ring was full or the thread had no ring */
+static std::atomic<bool> recordOverflow(false);
+static FILE *recordFile = NULL;
+/** Writes the rings to the file periodically, so the engine never waits on the disk */
+static std::thread writerThread;
+static int64_t recordStartFrame = 0;
+/** Index of each module in the recorded patch. Only changed while the engine is stopped, since engine threads read it without a lock. */
+static std::unordered_map<const Module*, int> recordModuleIds;
+static int recordBlockSize = 1;
+
+// Output hashing, on the engine thread
+
+static uint64_t hashState = HASH_OFFSET;
+static int64_t hashStartFrame = 0;
+
+// Replay
+
+struct ReplayEvent {
+	RecordType type;
+	int64_t frame;
+	Module *module;
+	int paramId;
+	float value;
+	float lambda;
+	MidiMessage message;
+};
+
+struct ReplayAudioFrame {
+	int64_t frame;
+	int channels;
+	/** Index of the first voltage in `ReplayStream::voltages` */
+	size_t offset;
+};
+
+/** Device input read by one module, which only the thread stepping it reads */
+struct ReplayStream {
+	std::vector<std::pair<int64_t, MidiMessage>> midi;
+	size_t midiPos = 0;
+	std::vector<ReplayAudioFrame> audio;
+	std::vector<float> voltages;
+	size_t audioPos = 0;
+};
+
+static bool replaying = false;
+static int64_t replayStartFrame = 0;
+static int64_t replayFrames = 0;
+static std::vector<ReplayEvent> replayEvents;
+static size_t replayEventPos = 0;
+static std::vector<std::pair<int64_t, int>> replayBlockSizes;
+static size_t replayBlockSizePos = 0;
+static std::unordered_map<const Module*, ReplayStream> replayStreams;
+static std::vector<std::pair<int64_t, uint64_t>> replayHashes;
+static size_t replayHashPos = 0;
+static int hashesChecked = 0;
+static int hashMismatches = 0;
+static int64_t firstMismatchFrame = -1;
+
+
+/** Writes the records appended to each ring so far. Records of different threads end up out of order, so the replay sorts them by frame. */
+static void writeRings() {
+	for (SPSCRingBuffer<uint8_t> *ring : recordRings) {
+		size_t n;
+		while ((n = ring->startSize()) > 0) {
+			fwrite(ring->startData(), 1, n, recordFile);
+			ring->startIncr(n);
+		}
+	}
+}
+
+static void writerRun() {
+	while (recording) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		writeRings();
+	}
+}
+
+/** Writes the record type, frame, and module ID. Returns false if the module is not part of the recorded patch. */
+static bool beginRecord(RecordWriter &w, RecordType type, const Module *module, int64_t frame) {
+	int moduleId = -1;
+	if (module) {
+		auto it = recordModuleIds.find(module);
+		if (it == recordModuleIds.end())
+			return false;
+		moduleId = it->second;
+	}
+	w.u8(type);
+	w.varint(std::max(frame - recordStartFrame, (int64_t) 0));
+	w.varint(moduleId + 1);
+	return true;
+}
+
+/** Appends a record to the calling engine thread's ring, publishing it whole so the writer never sees part of it */
+static void appendRecord(const RecordWriter &w) {
+	// Drop records from modules still stepping after the recording has stopped
+	if (!recording)
+		return;
+	size_t threadIndex = engineGetThreadIndex();
+	if (threadIndex >= recordRings.size() || recordRings[threadIndex]->capacity() < (size_t) w.len) {
+		recordOverflow = true;
+		return;
+	}
+	SPSCRingBuffer<uint8_t> *ring = recordRings[threadIndex];
+	size_t n = std::min(ring->endCapacity(), (size_t) w.len);
+	memcpy(ring->endData(), w.data, n);
+	// Wrap around to the start of the ring
+	memcpy(ring->data.data(), w.data + n, w.len - n);
+	ring->endIncr(w.len);
+}
+
+static void writeHeader(float sampleRate, int blockSize, uint64_t seed, const char *patch) {
+	uint32_t patchLen = strlen(patch);
+	fwrite(RECORDING_MAGIC, 1, sizeof(RECORDING_MAGIC), recordFile);
+	fwrite(&RECORDING_VERSION, sizeof(RECORDING_VERSION), 1, recordFile);
+	fwrite(&sampleRate, sizeof(sampleRate), 1, recordFile);
+	uint32_t blockSize32 = blockSize;
+	fwrite(&blockSize32, sizeof(blockSize32), 1, recordFile);
+	fwrite(&seed, sizeof(seed), 1, recordFile);
+	fwrite(&patchLen, sizeof(patchLen), 1, recordFile);
+	fwrite(patch, 1, patchLen, recordFile);
+}
+
+bool recorderStart(std::string filename) {
+	if (recording || replaying)
+		return false;
+	FILE *file = fopen(filename.c_str(), "wb");
+	if (!file) {
+		warn("Could not open recording %s for writing", filename.c_str());
+		return false;
+	}
+	info("Recording engine input to %s", filename.c_str());
+
+	// Reload the patch on a stopped engine, so every module starts from the state the replay will load, on the same frame
+	engineStop();
+	uint64_t seed = randomu64();
+	randomSeed(seed);
+	Vec offset = gRackScene->scrollWidget->offset;
+	json_t *rootJ = gRackWidget->toJson();
+	gRackWidget->clear();
+	gRackWidget->fromJson(rootJ);
+	json_decref(rootJ);
+	gRackScene->scrollWidget->offset = offset;
+
+	// Save the reloaded patch, so module IDs are the order of the rack
+	rootJ = gRackWidget->toJson();
+	char *patch = json_dumps(rootJ, JSON_COMPACT);
+	json_decref(rootJ);
+	recordModuleIds.clear();
+	for (Widget *w : gRackWidget->moduleContainer->children) {
+		ModuleWidget *moduleWidget = dynamic_cast<ModuleWidget*>(w);
+		assert(moduleWidget);
+		int moduleId = recordModuleIds.size();
+		recordModuleIds[moduleWidget->module] = moduleId;
+	}
+
+	recordFile = file;
+	recordBlockSize = engineGetBlockSize();
+	writeHeader(engineGetSampleRate(), recordBlockSize, seed, patch);
+	free(patch);
+	recordStartFrame = engineGetFrame();
+	hashState = HASH_OFFSET;
+	hashStartFrame = 0;
+	// The engine is stopped, so no thread is appending
+	while ((int) recordRings.size() < std::max(engineGetMaxThreadCount(), engineGetThreadCount())) {
+		// The arena aligns the ring's indices to cache lines, which plain new doesn't before C++17
+		recordRings.push_back(new (arenaAlloc(sizeof(SPSCRingBuffer<uint8_t>))) SPSCRingBuffer<uint8_t>());
+	}
+	for (SPSCRingBuffer<uint8_t> *ring : recordRings) {
+		ring->resize(RECORD_RING_SIZE);
+	}
+	recordOverflow = false;
+	recording = true;
+	writerThread = std::thread(writerRun);
+	engineStart();
+	return true;
+}
+
+void recorderStop() {
+	if (!recording)
+		return;
+	int64_t frames = engineGetFrame() - recordStartFrame;
+	recording = false;
+	writerThread.join();
+	writeRings();
+
+	RecordWriter w;
+	w.u8(RECORD_END);
+	w.varint(frames);
+	w.varint(0);
+	fwrite(w.data, 1, w.len, recordFile);
+	fclose(recordFile);
+	recordFile = NULL;
+	// Keep recordModuleIds, since engine threads which read `recording` just before it was cleared may still look modules up.
+	// recorderStart() replaces it while the engine is stopped.
+	if (recordOverflow)
+		warn("Dropped records because the engine recorded faster than they could be written, so the replay will differ");
+	info("Recorded %lld frames of engine input", (long long) frames);
+}
+
+bool recorderIsRecording() {
+	return recording;
+}
+
+int64_t recorderGetFrames() {
+	if (!recording)
+		return 0;
+	return engineGetFrame() - recordStartFrame;
+}
+
+bool recorderIsActive() {
+	return recording || replaying;
+}
+
+
+void recorderParam(Module *module, int64_t frame, int paramId, float value) {
+	RecordWriter w;
+	if (!beginRecord(w, RECORD_PARAM, module, frame))
+		return;
+	w.varint(paramId);
+	w.f32(value);
+	appendRecord(w);
+}
+
+void recorderParamSmooth(Module *module, int64_t frame, int paramId, float value, float lambda) {
+	RecordWriter w;
+	if (!beginRecord(w, RECORD_PARAM_SMOOTH, module, frame))
+		return;
+	w.varint(paramId);
+	w.f32(value);
+	w.f32(lambda);
+	appendRecord(w);
+}
+
+void recorderReset(Module *module, int64_t frame) {
+	RecordWriter w;
+	if (!beginRecord(w, RECORD_RESET, module, frame))
+		return;
+	appendRecord(w);
+}
+
+void recorderRandomize(Module *module, int64_t frame) {
+	RecordWriter w;
+	if (!beginRecord(w, RECORD_RANDOMIZE, module, frame))
+		return;
+	appendRecord(w);
+}
+
+void recorderMidiMessage(Module *module, int64_t frame, MidiMessage message) {
+	RecordWriter w;
+	if (!beginRecord(w, RECORD_MIDI_MESSAGE, module, frame))
+		return;
+	w.u8(message.cmd);
+	w.u8(message.data1);
+	w.u8(message.data2);
+	appendRecord(w);
+}
+
+void recorderSampleRate(int64_t frame, float sampleRate) {
+	RecordWriter w;
+	beginRecord(w, RECORD_SAMPLE_RATE, NULL, frame);
+	w.f32(sampleRate);
+	appendRecord(w);
+}
+
+void recorderBlock(int64_t frame, int frames, uint64_t outputHash) {
+	if (recording && frames != recordBlockSize) {
+		// Record changes of the block size, including blocks shortened to fit an audio device's buffer
+		RecordWriter w;
+		beginRecord(w, RECORD_BLOCK_SIZE, NULL, frame);
+		w.varint(frames);
+		appendRecord(w);
+		recordBlockSize = frames;
+	}
+
+	hashState = (hashState ^ outputHash) * HASH_PRIME;
+	int64_t endFrame = frame + frames - (recording ? recordStartFrame : replayStartFrame);
+	if (endFrame - hashStartFrame < HASH_FRAMES)
+		return;
+
+	if (recording) {
+		RecordWriter w;
+		w.u8(RECORD_HASH);
+		w.varint(endFrame);
+		w.varint(0);
+		w.u64(hashState);
+		appendRecord(w);
+	}
+	else if (replaying) {
+		// Skip hashes the replay has passed without landing on, which only happens if the block sizes differ
+		while (replayHashPos < replayHashes.size() && replayHashes[replayHashPos].first < endFrame) {
+			replayHashPos++;
+		}
+		if (replayHashPos < replayHashes.size() && replayHashes[replayHashPos].first == endFrame) {
+			hashesChecked++;
+			if (replayHashes[replayHashPos].second != hashState) {
+				if (hashMismatches == 0)
+					firstMismatchFrame = hashStartFrame;
+				hashMismatches++;
+			}
+			replayHashPos++;
+		}
+	}
+	hashState = HASH_OFFSET;
+	hashStartFrame = endFrame;
+}
+
+void recorderMidiInput(MidiMessage message) {
+	RecordWriter w;
+	if (!beginRecord(w, RECORD_MIDI_INPUT, engineGetSteppingModule(), engineGetStepFrame()))
+		return;
+	w.u8(message.cmd);
+	w.u8(message.data1);
+	w.u8(message.data2);
+	appendRecord(w);
+}
+
+void recorderAudioInput(const float *voltages, int channels) {
+	channels = std::min(channels, RECORD_AUDIO_MAX_CHANNELS);
+	// Frames of silence are left out, since the replay reads missing frames as 0V
+	bool silent = true;
+	for (int i = 0; i < channels; i++) {
+		if (voltages[i] != 0.f)
+			silent = false;
+	}
+	if (silent)
+		return;
+
+	RecordWriter w;
+	if (!beginRecord(w, RECORD_AUDIO_INPUT, engineGetSteppingModule(), engineGetStepFrame()))
+		return;
+	w.u8(channels);
+	for (int i = 0; i < channels; i++) {
+		w.f32(voltages[i]);
+	}
+	appendRecord(w);
+}
+
+
+// Replay
+
+static void replayClear() {
+	replayEvents.clear();
+	replayEventPos = 0;
+	replayBlockSizes.clear();
+	replayBlockSizePos = 0;
+	replayStreams.clear();
+	replayHashes.clear();
+	replayHashPos = 0;
+	hashesChecked = 0;
+	hashMismatches = 0;
+	firstMismatchFrame = -1;
+	replayFrames = 0;
+}
+
+/** Reads the records following the header, returning false if they are truncated or refer to a module which doesn't exist */
+static bool readRecords(RecordReader &r, const std::vector<Module*> &modules) {
+	while (true) {
+		RecordType type = (RecordType) r.u8();
+		int64_t frame = r.varint();
+		int moduleId = (int) r.varint() - 1;
+		if (r.error)
+			return false;
+		Module *module = NULL;
+		if (moduleId >= 0) {
+			if (moduleId >= (int) modules.size())
+				return false;
+			module = modules[moduleId];
+		}
+		// Only sample rate, block size, hash, and end records apply to the whole engine
+		bool global = (type == RECORD_SAMPLE_RATE || type == RECORD_BLOCK_SIZE || type == RECORD_HASH || type == RECORD_END);
+		if (!global && !module)
+			return false;
+
+		ReplayEvent event;
+		event.type = type;
+		event.frame = frame;
+		event.module = module;
+		switch (type) {
+			case RECORD_END: {
+				replayFrames = frame;
+				return true;
+			} break;
+			case RECORD_PARAM: {
+				event.paramId = r.varint();
+				event.value = r.f32();
+				replayEvents.push_back(event);
+			} break;
+			case RECORD_PARAM_SMOOTH: {
+				event.paramId = r.varint();
+				event.value = r.f32();
+				event.lambda = r.f32();
+				replayEvents.push_back(event);
+			} break;
+			case RECORD_RESET:
+			case RECORD_RANDOMIZE: {
+				replayEvents.push_back(event);
+			} break;
+			case RECORD_MIDI_MESSAGE: {
+				event.message.cmd = r.u8();
+				event.message.data1 = r.u8();
+				event.message.data2 = r.u8();
+				replayEvents.push_back(event);
+			} break;
+			case RECORD_SAMPLE_RATE: {
+				event.value = r.f32();
+				replayEvents.push_back(event);
+			} break;
+			case RECORD_BLOCK_SIZE: {
+				replayBlockSizes.push_back(std::make_pair(frame, (int) r.varint()));
+			} break;
+			case RECORD_MIDI_INPUT: {
+				MidiMessage message;
+				message.cmd = r.u8();
+				message.data1 = r.u8();
+				message.data2 = r.u8();
+				replayStreams[module].midi.push_back(std::make_pair(frame, message));
+			} break;
+			case RECORD_AUDIO_INPUT: {
+				ReplayStream &stream = replayStreams[module];
+				ReplayAudioFrame audioFrame;
+				audioFrame.frame = frame;
+				audioFrame.channels = r.u8();
+				audioFrame.offset = stream.voltages.size();
+				for (int i = 0; i < audioFrame.channels; i++) {
+					stream.voltages.push_back(r.f32());
+				}
+				stream.audio.push_back(audioFrame);
+			} break;
+			case RECORD_HASH: {
+				replayHashes.push_back(std::make_pair(frame, r.u64()));
+			} break;
+			default: {
+				return false;
+			} break;
+		}
+		if ((type == RECORD_PARAM || type == RECORD_PARAM_SMOOTH) && event.paramId >= (int) module->params.size())
+			return false;
+		if (r.error)
+			return false;
+	}
+}
+
+bool recorderReplayStart(std::string filename) {
+	if (recording || replaying)
+		return false;
+	FILE *file = fopen(filename.c_str(), "rb");
+	if (!file) {
+		warn("Could not open recording %s", filename.c_str());
+		return false;
+	}
+	std::vector<uint8_t> data;
+	uint8_t buffer[1 << 16];
+	size_t len;
+	while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		data.insert(data.end(), buffer, buffer + len);
+	}
+	fclose(file);
+
+	// Header
+	RecordReader r(data.data(), data.size());
+	if (!r.has(sizeof(RECORDING_MAGIC)) || memcmp(&data[0], RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0) {
+		warn("%s is not a recording", filename.c_str());
+		return false;
+	}
+	r.pos += sizeof(RECORDING_MAGIC);
+	uint32_t version = r.u32();
+	if (version != RECORDING_VERSION) {
+		warn("Recording %s has unsupported version %u", filename.c_str(), version);
+		return false;
+	}
+	float sampleRate = r.f32();
+	int blockSize = r.u32();
+	uint64_t seed = r.u64();
+	uint32_t patchLen = r.u32();
+	if (!r.has(patchLen)) {
+		warn("Recording %s is truncated", filename.c_str());
+		return false;
+	}
+	std::string patch((const char*) &data[r.pos], patchLen);
+	r.pos += patchLen;
+
+	// Load the patch with the engine set up as it was when recording started
+	engineSetSampleRate(sampleRate);
+	engineSetBlockSize(blockSize);
+	randomSeed(seed);
+	json_error_t error;
+	json_t *rootJ = json_loads(patch.c_str(), 0, &error);
+	if (!rootJ) {
+		warn("Recording %s has an invalid patch: %s", filename.c_str(), error.text);
+		return false;
+	}
+	size_t modulesLen = json_array_size(json_object_get(rootJ, "modules"));
+	gRackWidget->clear();
+	gRackWidget->fromJson(rootJ);
+	json_decref(rootJ);
+
+	std::vector<Module*> modules;
+	for (Widget *w : gRackWidget->moduleContainer->children) {
+		ModuleWidget *moduleWidget = dynamic_cast<ModuleWidget*>(w);
+		assert(moduleWidget);
+		modules.push_back(moduleWidget->module);
+	}
+	if (modules.size() != modulesLen) {
+		warn("Could not load %d modules of the recorded patch", (int) (modulesLen - modules.size()));
+		return false;
+	}
+
+	replayClear();
+	if (!readRecords(r, modules)) {
+		warn("Recording %s is truncated or corrupt", filename.c_str());
+		replayClear();
+		return false;
+	}
+	// Events are recorded in the order they applied within each frame, so keep that order
+	std::stable_sort(replayEvents.begin(), replayEvents.end(), [](const ReplayEvent &a, const ReplayEvent &b) {
+		return a.frame < b.frame;
+	});
+	for (auto &it : replayStreams) {
+		ReplayStream &stream = it.second;
+		std::stable_sort(stream.midi.begin(), stream.midi.end(), [](const std::pair<int64_t, MidiMessage> &a, const std::pair<int64_t, MidiMessage> &b) {
+			return a.first < b.first;
+		});
+		std::stable_sort(stream.audio.begin(), stream.audio.end(), [](const ReplayAudioFrame &a, const ReplayAudioFrame &b) {
+			return a.frame < b.frame;
+		});
+	}
+	std::stable_sort(replayBlockSizes.begin(), replayBlockSizes.end(), [](const std::pair<int64_t, int> &a, const std::pair<int64_t, int> &b) {
+		return a.first < b.first;
+	});
+	std::sort(replayHashes.begin(), replayHashes.end());
+
+	info("Replaying %lld frames at %f Hz from %s", (long long) replayFrames, sampleRate, filename.c_str());
+	replayStartFrame = engineGetFrame();
+	hashState = HASH_OFFSET;
+	hashStartFrame = 0;
+	replaying = true;
+	return true;
+}
+
+void recorderReplayBlock() {
+	if (!replaying)
+		return;
+	int64_t frame = engineGetFrame() - replayStartFrame;
+
+	// Block size changes set the length of this block, so apply them first
+	int blockSize = engineGetBlockSize();
+	while (replayBlockSizePos < replayBlockSizes.size() && replayBlockSizes[replayBlockSizePos].first <= frame) {
+		blockSize = replayBlockSizes[replayBlockSizePos].second;
+		engineSetBlockSize(blockSize);
+		replayBlockSizePos++;
+	}
+
+	while (replayEventPos < replayEvents.size() && replayEvents[replayEventPos].frame < frame + blockSize) {
+		const ReplayEvent &event = replayEvents[replayEventPos++];
+		int64_t eventFrame = replayStartFrame + event.frame;
+		switch (event.type) {
+			case RECORD_PARAM: {
+				engineSetParam(event.module, event.paramId, event.value, eventFrame);
+			} break;
+			case RECORD_PARAM_SMOOTH: {
+				engineSetParamSmooth(event.module, event.paramId, event.value, event.lambda);
+			} break;
+			case RECORD_RESET: {
+				engineResetModule(event.module);
+			} break;
+			case RECORD_RANDOMIZE: {
+				engineRandomizeModule(event.module);
+			} break;
+			case RECORD_MIDI_MESSAGE: {
+				engineSendMidiMessage(event.module, event.message, eventFrame);
+			} break;
+			case RECORD_SAMPLE_RATE: {
+				engineSetSampleRate(event.value);
+			} break;
+			default: break;
+		}
+	}
+}
+
+bool recorderReplayStop() {
+	if (!replaying)
+		return true;
+	replaying = false;
+	bool identical = (hashMismatches == 0);
+	if (identical) {
+		info("Replay output is identical to the recording, %d hashes checked", hashesChecked);
+	}
+	else {
+		warn("Replay output differs from the recording in %d of %d hashes, first between frames %lld and %lld", hashMismatches, hashesChecked, (long long) firstMismatchFrame, (long long) (firstMismatchFrame + HASH_FRAMES));
+	}
+	replayClear();
+	return identical;
+}
+
+bool recorderIsReplaying() {
+	return replaying;
+}
+
+int64_t recorderGetReplayFrames() {
+	return replayFrames;
+}
+
+bool recorderReplayMidiInput(MidiMessage *message) {
+	auto it = replayStreams.find(engineGetSteppingModule());
+	if (it == replayStreams.end())
+		return false;
+	ReplayStream &stream = it->second;
+	int64_t frame = engineGetStepFrame() - replayStartFrame;
+	if (stream.midiPos < stream.midi.size() && stream.midi[stream.midiPos].first <= frame) {
+		*message = stream.midi[stream.midiPos++].second;
+		return true;
+	}
+	return false;
+}
+
+int recorderReplayAudioInput(float *voltages, int maxChannels) {
+	auto it = replayStreams.find(engineGetSteppingModule());
+	if (it == replayStreams.end())
+		return 0;
+	ReplayStream &stream = it->second;
+	int64_t frame = engineGetStepFrame() - replayStartFrame;
+	while (stream.audioPos < stream.audio.size() && stream.audio[stream.audioPos].frame < frame) {
+		stream.audioPos++;
+	}
+	if (stream.audioPos >= stream.audio.size() || stream.audio[stream.audioPos].frame != frame)
+		return 0;
+	const ReplayAudioFrame &audioFrame = stream.audio[stream.audioPos++];
+	int channels = std::min(audioFrame.channels, maxChannels);
+	memcpy(voltages, &stream.voltages[audioFrame.offset], sizeof(float) * channels);
+	return channels;
+}
+
+
+} // namespace rack
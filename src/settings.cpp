@@ -55,6 +55,27 @@ static json_t *settingsToJson() {
 	json_t *sampleRateJ = json_real(engineGetSampleRate());
 	json_object_set_new(rootJ, "sampleRate", sampleRateJ);
 
+	// threadCount
+	json_t *threadCountJ = json_integer(engineGetThreadCount());
+	json_object_set_new(rootJ, "threadCount", threadCountJ);
+
+	// blockSize
+	json_t *blockSizeJ = json_integer(engineGetBlockSize());
+	json_object_set_new(rootJ, "blockSize", blockSizeJ);
+
+	// realtime
+	const EngineRealtimeSettings &realtime = engineGetRealtimeSettings();
+	json_t *realtimeJ = json_object();
+	json_object_set_new(realtimeJ, "enabled", json_boolean(realtime.realtime));
+	json_object_set_new(realtimeJ, "priority", json_integer(realtime.priority));
+	json_t *cpusJ = json_array();
+	for (int cpu : realtime.cpus) {
+		json_array_append_new(cpusJ, json_integer(cpu));
+	}
+	json_object_set_new(realtimeJ, "cpus", cpusJ);
+	json_object_set_new(realtimeJ, "lockMemory", json_boolean(realtime.lockMemory));
+	json_object_set_new(rootJ, "realtime", realtimeJ);
+
 	// lastPath
 	json_t *lastPathJ = json_string(gRackWidget->lastPath.c_str());
 	json_object_set_new(rootJ, "lastPath", lastPathJ);
@@ -127,6 +148,43 @@ static void settingsFromJson(json_t *rootJ) {
 		engineSetSampleRate(sampleRate);
 	}
 
+	// threadCount
+	json_t *threadCountJ = json_object_get(rootJ, "threadCount");
+	if (threadCountJ)
+		engineSetThreadCount(json_integer_value(threadCountJ));
+
+	// blockSize
+	json_t *blockSizeJ = json_object_get(rootJ, "blockSize");
+	if (blockSizeJ)
+		engineSetBlockSize(json_integer_value(blockSizeJ));
+
+	// realtime
+	json_t *realtimeJ = json_object_get(rootJ, "realtime");
+	if (realtimeJ) {
+		EngineRealtimeSettings realtime;
+		json_t *enabledJ = json_object_get(realtimeJ, "enabled");
+		if (enabledJ)
+			realtime.realtime = json_boolean_value(enabledJ);
+		json_t *priorityJ = json_object_get(realtimeJ, "priority");
+		if (priorityJ)
+			realtime.priority = json_integer_value(priorityJ);
+		json_t *cpusJ = json_object_get(realtimeJ, "cpus");
+		size_t i;
+		json_t *cpuJ;
+		json_array_foreach(cpusJ, i, cpuJ) {
+			json_int_t cpu = json_integer_value(cpuJ);
+			if (cpu < 0 || cpu >= engineGetMaxCpus()) {
+				warn("Ignoring realtime CPU %lld, which is out of range for this OS", (long long) cpu);
+				continue;
+			}
+			realtime.cpus.push_back(cpu);
+		}
+		json_t *lockMemoryJ = json_object_get(realtimeJ, "lockMemory");
+		if (lockMemoryJ)
+			realtime.lockMemory = json_boolean_value(lockMemoryJ);
+		engineSetRealtimeSettings(realtime);
+	}
+
 	// lastPath
 	json_t *lastPathJ = json_object_get(rootJ, "lastPath");
 	if (lastPathJ)
@@ -40,6 +40,16 @@ void randomInit() {
 	}
 }
 
+void randomSeed(uint64_t seed) {
+	// Expand the seed with splitmix64, since xoroshiro128+ needs a state which isn't all zero
+	for (int i = 0; i < 2; i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		xoroshiro128plus_state[i] = z ^ (z >> 31);
+	}
+}
+
 uint32_t randomu32() {
 	return xoroshiro128plus_next() >> 32;
 }
@@ -636,6 +636,11 @@ bool windowGetFullScreen() {
 ////////////////////
 
 Font::Font(const std::string &filename) {
+	// Fonts can't be loaded without a window, for example when rendering offline
+	if (!gVg) {
+		handle = -1;
+		return;
+	}
 	handle = nvgCreateFont(gVg, filename.c_str(), filename.c_str());
 	if (handle >= 0) {
 		info("Loaded font %s", filename.c_str());
@@ -662,6 +667,10 @@ std::shared_ptr<Font> Font::load(const std::string &filename) {
 ////////////////////
 
 Image::Image(const std::string &filename) {
+	if (!gVg) {
+		handle = 0;
+		return;
+	}
 	handle = nvgCreateImage(gVg, filename.c_str(), NVG_IMAGE_REPEATX | NVG_IMAGE_REPEATY);
 	if (handle > 0) {
 		info("Loaded image %s", filename.c_str());
@@ -673,7 +682,8 @@ Image::Image(const std::string &filename) {
 
 Image::~Image() {
 	// TODO What if handle is invalid?
-	nvgDeleteImage(gVg, handle);
+	if (gVg)
+		nvgDeleteImage(gVg, handle);
 }
 
 std::shared_ptr<Image> Image::load(const std::string &filename) {
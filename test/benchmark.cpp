@@ -0,0 +1,490 @@
+// Benchmarks the engine and DSP primitives on synthetic patches, without any UI.
+// Prints one JSON object per line to stdout so results can be compared across releases.
+// Usage: benchmark [modules] [seconds of audio per engine benchmark]
+#include "engine.hpp"
+#include "dsp/filter.hpp"
+#include "dsp/digital.hpp"
+#include "dsp/resampler.hpp"
+#include <speex/speex_resampler.h>
+#include <chrono>
+#include <string>
+#include <algorithm>
+
+
+using namespace rack;
+
+
+/** Mixes its inputs into each output with a gain param, like a small matrix mixer */
+struct MixModule : Module {
+	enum {
+		CHANNELS = 4
+	};
+
+	MixModule() : Module(CHANNELS, CHANNELS, CHANNELS) {
+		for (int i = 0; i < CHANNELS; i++) {
+			params[i].value = 0.5f;
+		}
+	}
+
+	void step() override {
+		float sum = 0.f;
+		for (int i = 0; i < CHANNELS; i++) {
+			sum += inputs[i].value;
+		}
+		// Add a small offset so constant chains don't decay to denormals
+		for (int i = 0; i < CHANNELS; i++) {
+			outputs[i].value = sum * params[i].value + 0.001f;
+		}
+	}
+};
+
+
+/** The same as MixModule, overriding process() instead of step() */
+struct BlockMixModule : MixModule {
+	void process(int frames) override {
+		for (int i = 0; i < frames; i++) {
+			float sum = 0.f;
+			for (int c = 0; c < CHANNELS; c++) {
+				sum += inputs[c].buffer[i];
+			}
+			for (int c = 0; c < CHANNELS; c++) {
+				outputs[c].buffer[i] = sum * params[c].value + 0.001f;
+			}
+		}
+	}
+};
+
+
+enum Graph {
+	CHAIN,
+	FAN_OUT,
+	FEEDBACK,
+	RANDOM,
+	NUM_GRAPHS
+};
+
+static const char *graphNames[NUM_GRAPHS] = {
+	"chain",
+	"fanOut",
+	"feedback",
+	"random"
+};
+
+
+struct Patch {
+	std::vector<Module*> modules;
+	std::vector<Wire*> wires;
+
+	void addModules(int count, bool block) {
+		for (int i = 0; i < count; i++) {
+			Module *module = block ? new BlockMixModule() : new MixModule();
+			engineAddModule(module);
+			modules.push_back(module);
+		}
+	}
+
+	void addWire(Module *outputModule, int outputId, Module *inputModule, int inputId) {
+		Wire *wire = new Wire();
+		wire->outputModule = outputModule;
+		wire->outputId = outputId;
+		wire->inputModule = inputModule;
+		wire->inputId = inputId;
+		engineAddWire(wire);
+		wires.push_back(wire);
+	}
+
+	void addWires(Graph graph) {
+		int count = modules.size();
+		switch (graph) {
+			case CHAIN: {
+				for (int i = 0; i + 1 < count; i++) {
+					addWire(modules[i], 0, modules[i + 1], 0);
+				}
+			} break;
+			case FAN_OUT: {
+				for (int i = 1; i < count; i++) {
+					addWire(modules[0], 0, modules[i], 0);
+				}
+			} break;
+			case FEEDBACK: {
+				for (int i = 0; i < count; i++) {
+					addWire(modules[i], 0, modules[(i + 1) % count], 0);
+				}
+			} break;
+			case RANDOM: {
+				// Patch about half of the inputs from random outputs, with a fixed seed so every run builds the same graph
+				uint32_t seed = 1;
+				for (int i = 0; i < count; i++) {
+					for (int j = 0; j < MixModule::CHANNELS; j += 2) {
+						seed = seed * 1664525 + 1013904223;
+						int outputModule = (seed >> 8) % count;
+						addWire(modules[outputModule], (seed >> 4) % MixModule::CHANNELS, modules[i], j);
+					}
+				}
+			} break;
+			default: break;
+		}
+	}
+
+	void clear() {
+		for (Wire *wire : wires) {
+			engineRemoveWire(wire);
+			delete wire;
+		}
+		wires.clear();
+		for (Module *module : modules) {
+			engineRemoveModule(module);
+			delete module;
+		}
+		modules.clear();
+	}
+};
+
+
+static double getTime() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Prints a result and takes ownership of `resultJ` */
+static void report(json_t *resultJ) {
+	char *line = json_dumps(resultJ, JSON_COMPACT | JSON_PRESERVE_ORDER | JSON_REAL_PRECISION(6));
+	printf("%s\n", line);
+	fflush(stdout);
+	free(line);
+	json_decref(resultJ);
+}
+
+
+static void benchmarkEngine(Graph graph, int modulesCount, bool block, int blockSize, int threadCount, double seconds) {
+	Patch patch;
+	patch.addModules(modulesCount, block);
+	patch.addWires(graph);
+
+	engineSetBlockSize(blockSize);
+	engineSetThreadCount(threadCount);
+	engineRenderStart();
+	// Warm up caches and spawn worker threads
+	for (int i = 0; i < 16; i++) {
+		engineRenderBlock();
+	}
+	long frames = 0;
+	long targetFrames = (long) (seconds * engineGetSampleRate());
+	double startTime = getTime();
+	while (frames < targetFrames) {
+		frames += engineRenderBlock();
+	}
+	double duration = getTime() - startTime;
+	engineRenderStop();
+
+	json_t *resultJ = json_object();
+	json_object_set_new(resultJ, "benchmark", json_string("engine"));
+	json_object_set_new(resultJ, "graph", json_string(graphNames[graph]));
+	json_object_set_new(resultJ, "modules", json_integer(patch.modules.size()));
+	json_object_set_new(resultJ, "wires", json_integer(patch.wires.size()));
+	json_object_set_new(resultJ, "process", json_boolean(block));
+	json_object_set_new(resultJ, "blockSize", json_integer(blockSize));
+	json_object_set_new(resultJ, "threads", json_integer(threadCount));
+	json_object_set_new(resultJ, "nsPerFrame", json_real(duration / frames * 1e9));
+	json_object_set_new(resultJ, "framesPerSecond", json_real(frames / duration));
+	report(resultJ);
+
+	patch.clear();
+}
+
+
+static void benchmarkWires(int modulesCount) {
+	Patch patch;
+	patch.addModules(modulesCount, false);
+
+	double startTime = getTime();
+	patch.addWires(RANDOM);
+	double addDuration = getTime() - startTime;
+	int wiresCount = patch.wires.size();
+
+	startTime = getTime();
+	for (Wire *wire : patch.wires) {
+		engineRemoveWire(wire);
+		delete wire;
+	}
+	double removeDuration = getTime() - startTime;
+	patch.wires.clear();
+
+	json_t *resultJ = json_object();
+	json_object_set_new(resultJ, "benchmark", json_string("wires"));
+	json_object_set_new(resultJ, "modules", json_integer(modulesCount));
+	json_object_set_new(resultJ, "wires", json_integer(wiresCount));
+	json_object_set_new(resultJ, "nsPerAdd", json_real(addDuration / wiresCount * 1e9));
+	json_object_set_new(resultJ, "nsPerRemove", json_real(removeDuration / wiresCount * 1e9));
+	report(resultJ);
+
+	patch.clear();
+}
+
+
+/** Serializes a patch in the same layout as RackWidget::toJson() */
+static json_t *patchToJson(Patch &patch) {
+	json_t *rootJ = json_object();
+	json_t *modulesJ = json_array();
+	for (Module *module : patch.modules) {
+		json_t *moduleJ = json_object();
+		json_object_set_new(moduleJ, "plugin", json_string("Benchmark"));
+		json_object_set_new(moduleJ, "model", json_string("Mix"));
+		json_t *paramsJ = json_array();
+		for (int i = 0; i < (int) module->params.size(); i++) {
+			json_t *paramJ = json_object();
+			json_object_set_new(paramJ, "paramId", json_integer(i));
+			json_object_set_new(paramJ, "value", json_real(module->params[i].value));
+			json_array_append_new(paramsJ, paramJ);
+		}
+		json_object_set_new(moduleJ, "params", paramsJ);
+		json_array_append_new(modulesJ, moduleJ);
+	}
+	json_object_set_new(rootJ, "modules", modulesJ);
+
+	json_t *wiresJ = json_array();
+	for (Wire *wire : patch.wires) {
+		int outputModuleId = std::find(patch.modules.begin(), patch.modules.end(), wire->outputModule) - patch.modules.begin();
+		int inputModuleId = std::find(patch.modules.begin(), patch.modules.end(), wire->inputModule) - patch.modules.begin();
+		json_t *wireJ = json_object();
+		json_object_set_new(wireJ, "outputModuleId", json_integer(outputModuleId));
+		json_object_set_new(wireJ, "outputId", json_integer(wire->outputId));
+		json_object_set_new(wireJ, "inputModuleId", json_integer(inputModuleId));
+		json_object_set_new(wireJ, "inputId", json_integer(wire->inputId));
+		json_array_append_new(wiresJ, wireJ);
+	}
+	json_object_set_new(rootJ, "wires", wiresJ);
+	return rootJ;
+}
+
+/** Parses and builds a patch the way RackWidget::fromJson() does, without creating widgets */
+static void patchFromJson(Patch &patch, json_t *rootJ) {
+	json_t *modulesJ = json_object_get(rootJ, "modules");
+	size_t moduleId;
+	json_t *moduleJ;
+	json_array_foreach(modulesJ, moduleId, moduleJ) {
+		Module *module = new MixModule();
+		json_t *paramsJ = json_object_get(moduleJ, "params");
+		size_t i;
+		json_t *paramJ;
+		json_array_foreach(paramsJ, i, paramJ) {
+			int paramId = json_integer_value(json_object_get(paramJ, "paramId"));
+			if (0 <= paramId && paramId < (int) module->params.size())
+				module->params[paramId].value = json_number_value(json_object_get(paramJ, "value"));
+		}
+		engineAddModule(module);
+		patch.modules.push_back(module);
+	}
+
+	json_t *wiresJ = json_object_get(rootJ, "wires");
+	size_t wireId;
+	json_t *wireJ;
+	json_array_foreach(wiresJ, wireId, wireJ) {
+		int outputModuleId = json_integer_value(json_object_get(wireJ, "outputModuleId"));
+		int outputId = json_integer_value(json_object_get(wireJ, "outputId"));
+		int inputModuleId = json_integer_value(json_object_get(wireJ, "inputModuleId"));
+		int inputId = json_integer_value(json_object_get(wireJ, "inputId"));
+		patch.addWire(patch.modules[outputModuleId], outputId, patch.modules[inputModuleId], inputId);
+	}
+}
+
+static void benchmarkPatchLoad(int modulesCount) {
+	std::string patchText;
+	{
+		Patch patch;
+		patch.addModules(modulesCount, false);
+		patch.addWires(RANDOM);
+		json_t *rootJ = patchToJson(patch);
+		char *text = json_dumps(rootJ, JSON_INDENT(2) | JSON_REAL_PRECISION(9));
+		patchText = text;
+		free(text);
+		json_decref(rootJ);
+		patch.clear();
+	}
+
+	Patch patch;
+	double startTime = getTime();
+	json_error_t error;
+	json_t *rootJ = json_loads(patchText.c_str(), 0, &error);
+	assert(rootJ);
+	double parseDuration = getTime() - startTime;
+	patchFromJson(patch, rootJ);
+	double loadDuration = getTime() - startTime;
+	json_decref(rootJ);
+
+	json_t *resultJ = json_object();
+	json_object_set_new(resultJ, "benchmark", json_string("patchLoad"));
+	json_object_set_new(resultJ, "modules", json_integer(patch.modules.size()));
+	json_object_set_new(resultJ, "wires", json_integer(patch.wires.size()));
+	json_object_set_new(resultJ, "bytes", json_integer(patchText.size()));
+	json_object_set_new(resultJ, "parseSeconds", json_real(parseDuration));
+	json_object_set_new(resultJ, "loadSeconds", json_real(loadDuration));
+	report(resultJ);
+
+	patch.clear();
+}
+
+
+/** Times `f(i)` for `samples` samples and reports the time per sample */
+template <typename F>
+static void benchmarkDsp(const char *name, long samples, F f) {
+	double startTime = getTime();
+	for (long i = 0; i < samples; i++) {
+		f(i);
+	}
+	double duration = getTime() - startTime;
+
+	json_t *resultJ = json_object();
+	json_object_set_new(resultJ, "benchmark", json_string("dsp"));
+	json_object_set_new(resultJ, "name", json_string(name));
+	json_object_set_new(resultJ, "nsPerSample", json_real(duration / samples * 1e9));
+	report(resultJ);
+}
+
+/** Keeps the compiler from optimizing away benchmarked results */
+static volatile float sink;
+
+static void benchmarkDsps() {
+	const long samples = 1 << 22;
+	// A test signal which crosses the trigger thresholds
+	auto signal = [](long i) {
+		return 5.f * sinf(i * 0.01f);
+	};
+
+	RCFilter rcFilter;
+	rcFilter.setCutoff(0.01f);
+	benchmarkDsp("RCFilter", samples, [&](long i) {
+		rcFilter.process(signal(i));
+		sink = rcFilter.lowpass();
+	});
+
+	SlewLimiter slewLimiter;
+	slewLimiter.setRiseFall(0.01f, 0.01f);
+	benchmarkDsp("SlewLimiter", samples, [&](long i) {
+		sink = slewLimiter.process(signal(i));
+	});
+
+	ExponentialFilter exponentialFilter;
+	exponentialFilter.lambda = 0.01f;
+	benchmarkDsp("ExponentialFilter", samples, [&](long i) {
+		sink = exponentialFilter.process(signal(i));
+	});
+
+	SchmittTrigger schmittTrigger;
+	benchmarkDsp("SchmittTrigger", samples, [&](long i) {
+		sink = schmittTrigger.process(signal(i));
+	});
+
+	Upsampler<8, 8> upsampler;
+	Decimator<8, 8> decimator;
+	float oversampled[8];
+	benchmarkDsp("Upsampler<8, 8>+Decimator<8, 8>", samples / 8, [&](long i) {
+		upsampler.process(signal(i), oversampled);
+		sink = decimator.process(oversampled);
+	});
+
+	SampleRateConverter<2> src;
+	src.setRates(44100, 48000);
+	const int srcBlock = 256;
+	Frame<2> srcIn[srcBlock] = {};
+	Frame<2> srcOut[2 * srcBlock];
+	benchmarkDsp("SampleRateConverter<2>", samples / srcBlock, [&](long i) {
+		for (int j = 0; j < srcBlock; j++) {
+			srcIn[j].samples[0] = srcIn[j].samples[1] = signal(i * srcBlock + j);
+		}
+		int inLen = srcBlock;
+		int outLen = 2 * srcBlock;
+		src.process(srcIn, &inLen, srcOut, &outLen);
+		sink = srcOut[0].samples[0];
+	});
+}
+
+/** Converts `seconds` of 44.1 kHz audio of CHANNELS channels to 48 kHz in blocks of an audio device's size.
+Compares SampleRateConverter, which filters all channels in one pass, with speexdsp filtering one channel at a time.
+*/
+template <int CHANNELS>
+static void benchmarkSampleRateConverter(double seconds) {
+	const int block = 256;
+	const long frames = (long) (seconds * 44100);
+	std::vector<Frame<CHANNELS>> in(block);
+	std::vector<Frame<CHANNELS>> out(2 * block);
+	for (int i = 0; i < block; i++) {
+		for (int c = 0; c < CHANNELS; c++) {
+			in[i].samples[c] = sinf((i + c) * 0.01f);
+		}
+	}
+
+	auto reportFrames = [&](const char *name, double duration) {
+		json_t *resultJ = json_object();
+		json_object_set_new(resultJ, "benchmark", json_string("src"));
+		json_object_set_new(resultJ, "name", json_string(name));
+		json_object_set_new(resultJ, "channels", json_integer(CHANNELS));
+		json_object_set_new(resultJ, "framesPerSecond", json_real(frames / duration));
+		report(resultJ);
+	};
+
+	SampleRateConverter<CHANNELS> src;
+	src.setRates(44100, 48000);
+	double startTime = getTime();
+	for (long frame = 0; frame < frames;) {
+		int inLen = block;
+		int outLen = 2 * block;
+		src.process(in.data(), &inLen, out.data(), &outLen);
+		frame += inLen;
+	}
+	reportFrames("SampleRateConverter", getTime() - startTime);
+	sink = out[0].samples[0];
+
+	int err;
+	SpeexResamplerState *st = speex_resampler_init(CHANNELS, 44100, 48000, SPEEX_RESAMPLER_QUALITY_DEFAULT, &err);
+	speex_resampler_set_input_stride(st, CHANNELS);
+	speex_resampler_set_output_stride(st, CHANNELS);
+	startTime = getTime();
+	for (long frame = 0; frame < frames;) {
+		spx_uint32_t inLen = block;
+		spx_uint32_t outLen = 2 * block;
+		for (int c = 0; c < CHANNELS; c++) {
+			inLen = block;
+			outLen = 2 * block;
+			speex_resampler_process_float(st, c, &in[0].samples[c], &inLen, &out[0].samples[c], &outLen);
+		}
+		frame += inLen;
+	}
+	reportFrames("speexdsp per channel", getTime() - startTime);
+	sink = out[0].samples[0];
+	speex_resampler_destroy(st);
+}
+
+
+int main(int argc, char *argv[]) {
+	int modulesCount = (argc > 1) ? atoi(argv[1]) : 100;
+	double seconds = (argc > 2) ? atof(argv[2]) : 1.0;
+
+	loggerInit(true);
+	engineInit();
+	engineSetSampleRate(44100.f);
+
+	std::vector<int> threadCounts = {1};
+	if (engineGetMaxThreadCount() > 1)
+		threadCounts.push_back(engineGetMaxThreadCount());
+
+	for (int graph = 0; graph < NUM_GRAPHS; graph++) {
+		for (int blockSize : {1, 64}) {
+			for (int threadCount : threadCounts) {
+				benchmarkEngine((Graph) graph, modulesCount, false, blockSize, threadCount, seconds);
+			}
+		}
+	}
+	// Modules which override process() only benefit from larger blocks
+	benchmarkEngine(CHAIN, modulesCount, true, 64, 1, seconds);
+
+	benchmarkWires(modulesCount);
+	benchmarkPatchLoad(modulesCount);
+	benchmarkDsps();
+	benchmarkSampleRateConverter<8>(10 * seconds);
+	benchmarkSampleRateConverter<16>(10 * seconds);
+	benchmarkSampleRateConverter<32>(10 * seconds);
+
+	engineDestroy();
+	loggerDestroy();
+	return 0;
+}
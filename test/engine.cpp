@@ -0,0 +1,838 @@
+// Regression tests for the engine's block stepping, without a window.
+// Prints each failed check and returns nonzero if any failed.
+#include "engine.hpp"
+#include "app.hpp"
+#include "plugin.hpp"
+#include "recorder.hpp"
+#include "dsp/resampler.hpp"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+
+using namespace rack;
+
+
+static int failures = 0;
+
+static void check(bool passed, const char *name) {
+	if (!passed) {
+		printf("FAIL %s\n", name);
+		failures++;
+	}
+}
+
+
+/** Outputs its param as a constant voltage */
+struct ConstantModule : Module {
+	ConstantModule() : Module(1, 0, 1) {}
+
+	void process(int frames) override {
+		for (int i = 0; i < frames; i++) {
+			outputs[0].buffer[i] = params[0].value;
+		}
+	}
+};
+
+/** Outputs a ramp on each of its channels, offset by the channel, from step() */
+struct PolyRampModule : Module {
+	enum {
+		CHANNELS = 4
+	};
+	float phase = 0.f;
+
+	PolyRampModule() : Module(0, 0, 1) {
+		outputs[0].maxChannels = CHANNELS;
+	}
+
+	void step() override {
+		outputs[0].setChannels(CHANNELS);
+		for (int c = 0; c < CHANNELS; c++) {
+			outputs[0].setVoltage(phase + c, c);
+		}
+		phase += 1.f;
+	}
+};
+
+/** Outputs a single frame of 10V at frame `pulseFrame` */
+struct PulseModule : Module {
+	int frame = 0;
+	int pulseFrame = 10;
+
+	PulseModule() : Module(0, 0, 1) {}
+
+	void step() override {
+		outputs[0].value = (frame++ == pulseFrame) ? 10.f : 0.f;
+	}
+};
+
+/** Counts the frames it is stepped and the MIDI messages it receives, with no effects besides its output */
+struct GeneratorModule : Module {
+	int steps = 0;
+	int messages = 0;
+
+	GeneratorModule() : Module(0, 0, 1) {
+		outputOnly = true;
+	}
+
+	void step() override {
+		steps++;
+		outputs[0].value = messages;
+	}
+
+	void onMidiMessage(MidiMessage message) override {
+		messages++;
+	}
+};
+
+/** Outputs its param, keeping the number of frames it processed and the sample rate it last saw */
+struct RateModule : Module {
+	int frames = 0;
+	float sampleRate = 0.f;
+
+	RateModule() : Module(1, 0, 1) {}
+
+	void process(int frames) override {
+		this->frames += frames;
+		sampleRate = engineGetSampleRate();
+		for (int i = 0; i < frames; i++) {
+			outputs[0].buffer[i] = params[0].value;
+		}
+	}
+};
+
+/** Smooths its input plus 1V with a one-pole filter */
+struct FilterModule : Module {
+	float state = 0.f;
+
+	FilterModule() : Module(0, 1, 1) {}
+
+	void process(int frames) override {
+		for (int i = 0; i < frames; i++) {
+			state += (inputs[0].buffer[i] + 1.f - state) * 0.5f;
+			outputs[0].buffer[i] = state;
+		}
+	}
+};
+
+/** Adds its param to its output each frame, and restarts from 0V on each MIDI message */
+struct AccumulatorModule : Module {
+	float sum = 0.f;
+
+	AccumulatorModule() : Module(1, 0, 1) {}
+
+	void process(int frames) override {
+		for (int i = 0; i < frames; i++) {
+			sum += params[0].value;
+			outputs[0].buffer[i] = sum;
+		}
+	}
+
+	void onMidiMessage(MidiMessage message) override {
+		sum = 0.f;
+	}
+};
+
+/** Keeps a copy of the block of each channel of its input */
+struct BlockSinkModule : Module {
+	float blocks[PORT_MAX_CHANNELS][ENGINE_MAX_BLOCK_SIZE] = {};
+	int frames = 0;
+
+	BlockSinkModule(int maxChannels = PORT_MAX_CHANNELS) : Module(0, 1, 0) {
+		inputs[0].maxChannels = maxChannels;
+	}
+
+	void process(int frames) override {
+		this->frames = frames;
+		for (int c = 0; c < std::max(inputs[0].channels, 1); c++) {
+			for (int i = 0; i < frames; i++) {
+				blocks[c][i] = inputs[0].getBuffer(c)[i];
+			}
+		}
+	}
+};
+
+
+static void renderBlocks(int blocks) {
+	engineRenderStart();
+	for (int i = 0; i < blocks; i++) {
+		engineRenderBlock();
+	}
+	engineRenderStop();
+}
+
+static Wire *addWire(Module *outputModule, Module *inputModule) {
+	Wire *wire = new Wire();
+	wire->outputModule = outputModule;
+	wire->outputId = 0;
+	wire->inputModule = inputModule;
+	wire->inputId = 0;
+	engineAddWire(wire);
+	return wire;
+}
+
+static void removeWire(Wire *wire) {
+	engineRemoveWire(wire);
+	delete wire;
+}
+
+static void removeModule(Module *module) {
+	engineRemoveModule(module);
+	delete module;
+}
+
+
+/** A cable from a constant output must carry the whole block after the clock shortens blocks and then returns to full blocks */
+static void testShortenedClockBlock() {
+	const int blockSize = 64;
+	ConstantModule *constant = new ConstantModule();
+	BlockSinkModule *sink = new BlockSinkModule();
+	engineAddModule(constant);
+	engineAddModule(sink);
+	Wire *wire = addWire(constant, sink);
+
+	engineSetBlockSize(blockSize);
+	engineSetParam(constant, 0, 1.f);
+	engineClockAcquire(constant);
+	engineStart();
+	// Fill the cable's whole block with 1V, until the cable holds steady
+	for (int i = 0; i < 4; i++) {
+		engineClockStep(constant, blockSize);
+	}
+	// Change the voltage during a shortened block, which holds steady through the next one
+	engineSetParam(constant, 0, 2.f);
+	engineClockStep(constant, blockSize / 2);
+	engineClockStep(constant, blockSize / 2);
+	// Full blocks, the second of which reads the cable copied during the first
+	engineClockStep(constant, blockSize);
+	engineClockStep(constant, blockSize);
+	engineStop();
+	engineClockRelease(constant);
+
+	check(sink->frames == blockSize, "shortened clock block: full block stepped");
+	bool stale = false;
+	for (int i = 0; i < sink->frames; i++) {
+		if (sink->blocks[0][i] != 2.f)
+			stale = true;
+	}
+	check(!stale, "shortened clock block: input block holds the new voltage");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(constant);
+}
+
+
+/** Blocks shortened to fit the device's buffer must not make unchanged cables and stateless modules recompute */
+static void testShortenedClockBlockSkips() {
+	const int blockSize = 64;
+	ConstantModule *constant = new ConstantModule();
+	constant->stateless = true;
+	BlockSinkModule *sink = new BlockSinkModule();
+	engineAddModule(constant);
+	engineAddModule(sink);
+	Wire *wire = addWire(constant, sink);
+
+	engineSetBlockSize(blockSize);
+	engineSetParam(constant, 0, 1.f);
+	gPowerMeter = true;
+	engineClockAcquire(constant);
+	engineStart();
+	for (int i = 0; i < 4; i++) {
+		engineClockStep(constant, blockSize);
+	}
+	// The counts are reset at the start of the next block
+	engineResetProfile();
+	for (int i = 0; i < 8; i++) {
+		engineClockStep(constant, blockSize - 24);
+		engineClockStep(constant, blockSize);
+	}
+	engineStop();
+	engineClockRelease(constant);
+	gPowerMeter = false;
+
+	EngineChangeCounts counts = engineGetChangeCounts();
+	check(counts.wireCopies == 0, "shortened clock block skips: cable not recopied");
+	check(counts.statelessSteps == 0, "shortened clock block skips: stateless module not stepped");
+	bool stale = false;
+	for (int i = 0; i < sink->frames; i++) {
+		if (sink->blocks[0][i] != 1.f)
+			stale = true;
+	}
+	check(sink->frames == blockSize && !stale, "shortened clock block skips: input block holds the voltage");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(constant);
+}
+
+
+/** Every channel of a polyphonic cable must carry a voltage for each frame, not one per block */
+static void testPolyphonicBlocks() {
+	const int blockSize = 64;
+	PolyRampModule *ramp = new PolyRampModule();
+	BlockSinkModule *sink = new BlockSinkModule();
+	engineAddModule(ramp);
+	engineAddModule(sink);
+	Wire *wire = addWire(ramp, sink);
+
+	engineSetBlockSize(blockSize);
+	engineRenderStart();
+	for (int i = 0; i < 4; i++) {
+		engineRenderBlock();
+	}
+	engineRenderStop();
+
+	check(sink->inputs[0].channels == PolyRampModule::CHANNELS, "polyphonic blocks: channel count");
+	bool held = false;
+	for (int c = 0; c < PolyRampModule::CHANNELS; c++) {
+		for (int i = 1; i < blockSize; i++) {
+			if (sink->blocks[c][i] != sink->blocks[c][i - 1] + 1.f)
+				held = true;
+		}
+		if (sink->blocks[c][0] != sink->blocks[0][0] + c)
+			held = true;
+	}
+	check(!held, "polyphonic blocks: every channel ramps each frame");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(ramp);
+}
+
+
+/** Ports only get blocks for the channels they declare, and monophonic inputs read the first channel of polyphonic cables */
+static void testPortChannelCounts() {
+	const int blockSize = 64;
+	PolyRampModule *ramp = new PolyRampModule();
+	BlockSinkModule *sink = new BlockSinkModule(1);
+	engineAddModule(ramp);
+	engineAddModule(sink);
+	Wire *wire = addWire(ramp, sink);
+
+	check(ramp->portBuffers.size() == PolyRampModule::CHANNELS * ENGINE_MAX_BLOCK_SIZE, "port channel counts: polyphonic output buffer");
+	check(sink->portBuffers.size() == ENGINE_MAX_BLOCK_SIZE, "port channel counts: monophonic input buffer");
+
+	engineSetBlockSize(blockSize);
+	engineRenderStart();
+	for (int i = 0; i < 4; i++) {
+		engineRenderBlock();
+	}
+	engineRenderStop();
+
+	check(sink->inputs[0].channels == 1, "port channel counts: cable cut to the input's channels");
+	bool ramps = true;
+	for (int i = 1; i < blockSize; i++) {
+		if (sink->blocks[0][i] != sink->blocks[0][i - 1] + 1.f)
+			ramps = false;
+	}
+	check(ramps && sink->blocks[1][0] == 0.f, "port channel counts: input reads the first channel");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(ramp);
+}
+
+
+/** An output-only module is only stepped while one of its outputs is plugged in, but still receives its MIDI messages */
+static void testOutputOnlySkips() {
+	const int blockSize = 64;
+	GeneratorModule *generator = new GeneratorModule();
+	BlockSinkModule *sink = new BlockSinkModule();
+	engineAddModule(generator);
+	engineAddModule(sink);
+
+	engineSetBlockSize(blockSize);
+	engineRenderStart();
+	engineSendMidiMessage(generator, MidiMessage());
+	for (int i = 0; i < 4; i++) {
+		engineRenderBlock();
+	}
+	engineRenderStop();
+	check(generator->steps == 0, "output-only skips: unplugged module not stepped");
+	check(generator->messages == 1, "output-only skips: MIDI message received while skipped");
+
+	Wire *wire = addWire(generator, sink);
+	engineRenderStart();
+	for (int i = 0; i < 4; i++) {
+		engineRenderBlock();
+	}
+	engineRenderStop();
+	check(generator->steps == 4 * blockSize, "output-only skips: plugged module stepped");
+	check(sink->blocks[0][blockSize - 1] == 1.f, "output-only skips: output carries the module's state");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(generator);
+}
+
+
+/** A pulse shorter than the plug lights' update period must still light them, whichever frame of the period it falls on */
+static void testPlugLightPeaks() {
+	PulseModule *pulse = new PulseModule();
+	BlockSinkModule *sink = new BlockSinkModule();
+	engineAddModule(pulse);
+	engineAddModule(sink);
+	Wire *wire = addWire(pulse, sink);
+
+	engineSetBlockSize(1);
+	engineRenderStart();
+	for (int i = 0; i < 128; i++) {
+		engineRenderBlock();
+	}
+	engineRenderStop();
+
+	check(pulse->outputs[0].plugLights[0].value > 0.f, "plug light peaks: single-frame pulse lights the output plug");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(pulse);
+}
+
+
+/** Smoothing a param while the engine is paused must neither wait forever on the full queue nor leave the param behind */
+static void testPausedSmoothing() {
+	ConstantModule *constant = new ConstantModule();
+	engineAddModule(constant);
+
+	engineStart();
+	gPaused = true;
+	// Many more requests than the queue holds, like dragging a knob while paused
+	for (int i = 0; i <= 10000; i++) {
+		engineSetParamSmooth(constant, 0, i * 1e-3f);
+	}
+	// Wait for the engine thread to jump to the last target
+	auto startTime = std::chrono::steady_clock::now();
+	while (constant->params[0].value != 10.f && std::chrono::steady_clock::now() - startTime < std::chrono::seconds(1)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	engineStop();
+	gPaused = false;
+
+	check(constant->params[0].value == 10.f, "paused smoothing: param jumps to the last target");
+
+	removeModule(constant);
+}
+
+
+/** Renders a few chains of filters fed by a constant, spread across `threadCount` threads, and returns the last block at the end of each chain */
+static std::vector<float> renderFilterChains(int threadCount) {
+	const int blockSize = 64;
+	const int chains = 4;
+	const int length = 8;
+	std::vector<Module*> modules;
+	std::vector<Wire*> wires;
+	std::vector<BlockSinkModule*> sinks;
+	ConstantModule *constant = new ConstantModule();
+	engineAddModule(constant);
+	engineSetParam(constant, 0, 1.f);
+	modules.push_back(constant);
+	for (int chain = 0; chain < chains; chain++) {
+		Module *previous = constant;
+		for (int i = 0; i < length; i++) {
+			FilterModule *filter = new FilterModule();
+			engineAddModule(filter);
+			wires.push_back(addWire(previous, filter));
+			modules.push_back(filter);
+			previous = filter;
+		}
+		BlockSinkModule *sink = new BlockSinkModule();
+		engineAddModule(sink);
+		wires.push_back(addWire(previous, sink));
+		modules.push_back(sink);
+		sinks.push_back(sink);
+	}
+
+	engineSetBlockSize(blockSize);
+	engineSetThreadCount(threadCount);
+	renderBlocks(16);
+	engineSetThreadCount(1);
+
+	std::vector<float> blocks;
+	for (BlockSinkModule *sink : sinks) {
+		blocks.insert(blocks.end(), sink->blocks[0], sink->blocks[0] + blockSize);
+	}
+	for (Wire *wire : wires) {
+		removeWire(wire);
+	}
+	for (Module *module : modules) {
+		removeModule(module);
+	}
+	return blocks;
+}
+
+/** Stepping modules on several threads must give the same output as stepping them on one */
+static void testMultithreadedStepping() {
+	std::vector<float> single = renderFilterChains(1);
+	std::vector<float> multiple = renderFilterChains(4);
+	check(single[0] > 0.f, "multithreaded stepping: chains carry the voltage");
+	check(single == multiple, "multithreaded stepping: output matches one thread");
+}
+
+
+/** Edits sent while the engine thread runs must apply in order, even with many more than the queue holds */
+static void testCommandQueue() {
+	const int blockSize = 64;
+	ConstantModule *constant = new ConstantModule();
+	BlockSinkModule *sink = new BlockSinkModule();
+	engineAddModule(constant);
+	engineAddModule(sink);
+	engineSetParam(constant, 0, 1.f);
+
+	engineSetBlockSize(blockSize);
+	engineStart();
+	bool bypassed = true;
+	for (int i = 0; i < 1000; i++) {
+		removeWire(addWire(constant, sink));
+		ConstantModule *extra = new ConstantModule();
+		engineAddModule(extra);
+		// Bypassing waits for the engine thread, so the module has caught up with the queue
+		engineSetModuleBypass(extra, true);
+		if (!extra->bypassed)
+			bypassed = false;
+		removeModule(extra);
+	}
+	Wire *wire = addWire(constant, sink);
+	engineStop();
+	check(bypassed, "command queue: bypass applied before returning");
+
+	renderBlocks(2);
+	check(sink->inputs[0].active, "command queue: last cable plugged in");
+	check(sink->blocks[0][0] == 1.f && sink->blocks[0][blockSize - 1] == 1.f, "command queue: last cable carries the voltage");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(constant);
+}
+
+
+/** Param changes and MIDI messages sent for a frame within a block must apply at that frame */
+static void testEventSlicing() {
+	const int blockSize = 64;
+	ConstantModule *constant = new ConstantModule();
+	GeneratorModule *generator = new GeneratorModule();
+	BlockSinkModule *paramSink = new BlockSinkModule();
+	BlockSinkModule *midiSink = new BlockSinkModule();
+	engineAddModule(constant);
+	engineAddModule(generator);
+	engineAddModule(paramSink);
+	engineAddModule(midiSink);
+	Wire *paramWire = addWire(constant, paramSink);
+	Wire *midiWire = addWire(generator, midiSink);
+
+	engineSetBlockSize(blockSize);
+	engineRenderStart();
+	engineRenderBlock();
+	int64_t frame = engineGetFrame();
+	engineSetParam(constant, 0, 1.f, frame + 20);
+	engineSendMidiMessage(generator, MidiMessage(), frame + 30);
+	engineRenderBlock();
+	// The sinks read the cables copied during the previous block
+	engineRenderBlock();
+	engineRenderStop();
+
+	check(paramSink->blocks[0][19] == 0.f && paramSink->blocks[0][20] == 1.f, "event slicing: param changes at its frame");
+	check(midiSink->blocks[0][29] == 0.f && midiSink->blocks[0][30] == 1.f, "event slicing: MIDI message arrives at its frame");
+
+	removeWire(midiWire);
+	removeWire(paramWire);
+	removeModule(midiSink);
+	removeModule(paramSink);
+	removeModule(generator);
+	removeModule(constant);
+}
+
+
+/** A bypassed module is not stepped and outputs 0V, and carries on from its state when unbypassed */
+static void testBypass() {
+	const int blockSize = 64;
+	GeneratorModule *generator = new GeneratorModule();
+	BlockSinkModule *sink = new BlockSinkModule();
+	engineAddModule(generator);
+	engineAddModule(sink);
+	Wire *wire = addWire(generator, sink);
+	engineSendMidiMessage(generator, MidiMessage());
+
+	engineSetBlockSize(blockSize);
+	renderBlocks(2);
+	check(generator->steps == 2 * blockSize && sink->blocks[0][blockSize - 1] == 1.f, "bypass: module stepped before bypassing");
+
+	engineSetModuleBypass(generator, true);
+	renderBlocks(2);
+	check(generator->steps == 2 * blockSize, "bypass: bypassed module not stepped");
+	check(sink->blocks[0][0] == 0.f && sink->blocks[0][blockSize - 1] == 0.f, "bypass: bypassed module outputs 0V");
+
+	engineSetModuleBypass(generator, false);
+	renderBlocks(2);
+	check(generator->steps == 4 * blockSize, "bypass: module stepped again after unbypassing");
+	check(sink->blocks[0][blockSize - 1] == 1.f, "bypass: module keeps its state");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(generator);
+}
+
+
+/** Ports are active while plugged in, outputs stay active until their last cable is removed, and unplugged inputs read 0V */
+static void testPortActivity() {
+	ConstantModule *constant = new ConstantModule();
+	BlockSinkModule *sink1 = new BlockSinkModule();
+	BlockSinkModule *sink2 = new BlockSinkModule();
+	engineAddModule(constant);
+	engineAddModule(sink1);
+	engineAddModule(sink2);
+	engineSetParam(constant, 0, 1.f);
+
+	Wire *wire1 = addWire(constant, sink1);
+	check(constant->outputs[0].active && sink1->inputs[0].active && !sink2->inputs[0].active, "port activity: plugged ports active");
+	Wire *wire2 = addWire(constant, sink2);
+	renderBlocks(2);
+	check(sink1->inputs[0].buffer[0] == 1.f, "port activity: plugged input reads the cable");
+
+	removeWire(wire1);
+	check(constant->outputs[0].active && !sink1->inputs[0].active && sink2->inputs[0].active, "port activity: output active while a cable remains");
+	check(sink1->inputs[0].buffer[0] == 0.f, "port activity: unplugged input reads 0V");
+	removeWire(wire2);
+	check(!constant->outputs[0].active && !sink2->inputs[0].active, "port activity: output inactive after its last cable");
+
+	removeModule(sink2);
+	removeModule(sink1);
+	removeModule(constant);
+}
+
+
+/** An oversampled module processes a multiple of the frames at a multiple of the sample rate, and its decimated output keeps DC */
+static void testOversampling() {
+	const int blockSize = 64;
+	const int oversample = 4;
+	RateModule *rate = new RateModule();
+	BlockSinkModule *sink = new BlockSinkModule();
+	engineAddModule(rate);
+	engineAddModule(sink);
+	Wire *wire = addWire(rate, sink);
+	engineSetParam(rate, 0, 1.f);
+
+	engineSetBlockSize(blockSize);
+	engineSetModuleOversample(rate, oversample);
+	renderBlocks(16);
+	check(rate->frames == 16 * blockSize * oversample, "oversampling: frames multiplied");
+	check(rate->sampleRate == engineGetSampleRate() * oversample, "oversampling: sample rate multiplied");
+	check(fabsf(sink->blocks[0][0] - 1.f) < 1e-3f && fabsf(sink->blocks[0][blockSize - 1] - 1.f) < 1e-3f, "oversampling: output keeps DC");
+
+	engineSetModuleOversample(rate, 1);
+	check(!rate->oversampler, "oversampling: state freed when turned off");
+	rate->frames = 0;
+	renderBlocks(1);
+	check(rate->frames == blockSize && rate->sampleRate == engineGetSampleRate(), "oversampling: original rate restored");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(rate);
+}
+
+
+/** A stateless module is skipped while nothing it reads changes, and processes again until steady when its param changes */
+static void testStatelessSkips() {
+	const int blockSize = 64;
+	ConstantModule *constant = new ConstantModule();
+	constant->stateless = true;
+	BlockSinkModule *sink = new BlockSinkModule();
+	engineAddModule(constant);
+	engineAddModule(sink);
+	Wire *wire = addWire(constant, sink);
+	engineSetParam(constant, 0, 1.f);
+
+	engineSetBlockSize(blockSize);
+	gPowerMeter = true;
+	renderBlocks(4);
+	// The counts are reset at the start of the next block
+	engineResetProfile();
+	renderBlocks(8);
+	EngineChangeCounts counts = engineGetChangeCounts();
+	check(counts.statelessSteps == 0 && counts.statelessSkips == 8, "stateless skips: steady module skipped");
+	check(counts.wireCopies == 0, "stateless skips: steady cable not copied");
+
+	engineSetParam(constant, 0, 2.f);
+	engineResetProfile();
+	renderBlocks(4);
+	counts = engineGetChangeCounts();
+	gPowerMeter = false;
+	check(counts.statelessSteps > 0, "stateless skips: module processed after its param changed");
+	check(counts.statelessSkips > 0, "stateless skips: module skipped again once steady");
+	check(sink->blocks[0][blockSize - 1] == 2.f, "stateless skips: output carries the new voltage");
+
+	removeWire(wire);
+	removeModule(sink);
+	removeModule(constant);
+}
+
+
+/** Replaying a recording of param changes and MIDI messages sent to the running engine must reproduce its output bit for bit */
+static void testRecordReplay() {
+	const std::string filename = "engine_test_recording.bin";
+	// The recorder saves and reloads the patch through the rack, so the module needs a model and a widget
+	Plugin *plugin = new Plugin();
+	plugin->slug = "Test";
+	plugin->addModel(Model::create<AccumulatorModule, ModuleWidget>("Test", "Accumulator", "Accumulator"));
+	gPlugins.push_back(plugin);
+	gRackScene = new RackScene();
+	gRackWidget->addModule(plugin->models.front()->createModuleWidget());
+
+	engineSetBlockSize(64);
+	engineStart();
+	check(recorderStart(filename), "record replay: recording started");
+	// Recording reloads the patch, so find the new module
+	Module *module = dynamic_cast<ModuleWidget*>(gRackWidget->moduleContainer->children.front())->module;
+	for (int i = 0; i < 50; i++) {
+		engineSetParam(module, 0, i * 1e-3f, engineGetFrame() + i);
+		if (i % 10 == 0)
+			engineSendMidiMessage(module, MidiMessage(), engineGetFrame() + 100);
+		std::this_thread::sleep_for(std::chrono::milliseconds(4));
+	}
+	recorderStop();
+	engineStop();
+
+	check(recorderReplayStart(filename), "record replay: replay started");
+	int64_t frames = recorderGetReplayFrames();
+	// The output is checked every 4096 frames
+	check(frames >= 4096, "record replay: output recorded");
+	engineRenderStart();
+	for (int64_t frame = 0; frame < frames;) {
+		recorderReplayBlock();
+		frame += engineRenderBlock();
+	}
+	engineRenderStop();
+	check(recorderReplayStop(), "record replay: replayed output matches the recording");
+
+	gRackWidget->clear();
+	remove(filename.c_str());
+}
+
+
+/** Converts a second of a sine of `freq` Hz with amplitude 0.5, `chunk` input frames at a time, and returns the ratio of the input rate to the output rate */
+static double convertSine(int inRate, int outRate, double correction, int chunk, double freq, std::vector<float> &out) {
+	SampleRateConverter<1> src;
+	src.setChannels(1);
+	src.setRates(inRate, outRate);
+	src.setRateCorrection(correction);
+	std::vector<Frame<1>> in(inRate);
+	for (int i = 0; i < inRate; i++) {
+		in[i].samples[0] = 0.5 * sin(2 * M_PI * freq * i / inRate);
+	}
+	out.clear();
+	int pos = 0;
+	while (pos < inRate) {
+		int inFrames = std::min(chunk, inRate - pos);
+		Frame<1> outBuffer[1024];
+		int outFrames = 1024;
+		src.process(&in[pos], &inFrames, outBuffer, &outFrames);
+		if (inFrames == 0 && outFrames == 0)
+			break;
+		pos += inFrames;
+		for (int i = 0; i < outFrames; i++) {
+			out.push_back(outBuffer[i].samples[0]);
+		}
+	}
+	return src.getRatio();
+}
+
+/** Returns the power of the sine of `freq` cycles per frame which best fits the middle half of `x`, skipping the filter's delay and tail. The power of the rest is stored in `residual`. */
+static double fitSine(const std::vector<float> &x, double freq, double *residual) {
+	size_t start = x.size() / 4;
+	size_t end = x.size() * 3 / 4;
+	double ss = 0.0, sc = 0.0, cc = 0.0, xs = 0.0, xc = 0.0;
+	for (size_t i = start; i < end; i++) {
+		double s = sin(2 * M_PI * freq * i);
+		double c = cos(2 * M_PI * freq * i);
+		ss += s * s;
+		sc += s * c;
+		cc += c * c;
+		xs += x[i] * s;
+		xc += x[i] * c;
+	}
+	double det = ss * cc - sc * sc;
+	double a = (xs * cc - xc * sc) / det;
+	double b = (xc * ss - xs * sc) / det;
+	double power = 0.0;
+	double error = 0.0;
+	for (size_t i = start; i < end; i++) {
+		double y = a * sin(2 * M_PI * freq * i) + b * cos(2 * M_PI * freq * i);
+		power += y * y;
+		error += (x[i] - y) * (x[i] - y);
+	}
+	if (residual)
+		*residual = error / (end - start);
+	return power / (end - start);
+}
+
+/** Converting between 44.1 and 48 kHz must keep the SNR and the rejection of images and aliases of the default quality, whether or not the ratio is corrected for drift, and however the input is chunked */
+static void testSampleRateConverterQuality() {
+	const double minDb = 80.0;
+	const int rates[][2] = {{44100, 48000}, {48000, 44100}};
+	const double corrections[] = {1.0, 1.0005};
+	const int chunks[] = {1, 7, 64, 512};
+	std::vector<float> out;
+	for (const int *rate : rates) {
+		for (double correction : corrections) {
+			for (int chunk : chunks) {
+				bool passed = true;
+				// Sines in the passband come through without distortion
+				for (double freq : {1000.0, 15000.0}) {
+					double ratio = convertSine(rate[0], rate[1], correction, chunk, freq, out);
+					double noise;
+					double power = fitSine(out, freq / rate[0] * ratio, &noise);
+					if (10 * log10(power / noise) < minDb)
+						passed = false;
+				}
+				if (rate[0] < rate[1]) {
+					// Upsampling images a 15 kHz sine at 29.1 kHz, which folds back to 18.9 kHz at 48 kHz
+					double freq = 15000.0;
+					double ratio = convertSine(rate[0], rate[1], correction, chunk, freq, out);
+					double power = fitSine(out, freq / rate[0] * ratio, NULL);
+					double image = fitSine(out, 1.0 - (rate[0] - freq) / rate[0] * ratio, NULL);
+					if (10 * log10(power / image) < minDb)
+						passed = false;
+				}
+				else {
+					// Downsampling rejects a 23 kHz sine above the output's Nyquist frequency rather than aliasing it to 21.1 kHz
+					double ratio = convertSine(rate[0], rate[1], correction, chunk, 23000.0, out);
+					double alias = fitSine(out, 1.0 - 23000.0 / rate[0] * ratio, NULL);
+					if (10 * log10(0.125 / alias) < minDb)
+						passed = false;
+				}
+				char name[128];
+				snprintf(name, sizeof(name), "sample rate converter quality: %d to %d Hz, correction %g, chunks of %d", rate[0], rate[1], correction, chunk);
+				check(passed, name);
+			}
+		}
+	}
+}
+
+
+int main(int argc, char *argv[]) {
+	engineInit();
+	testShortenedClockBlock();
+	testShortenedClockBlockSkips();
+	testPolyphonicBlocks();
+	testPortChannelCounts();
+	testOutputOnlySkips();
+	testPlugLightPeaks();
+	testPausedSmoothing();
+	testMultithreadedStepping();
+	testCommandQueue();
+	testEventSlicing();
+	testBypass();
+	testPortActivity();
+	testOversampling();
+	testStatelessSkips();
+	testRecordReplay();
+	testSampleRateConverterQuality();
+	engineDestroy();
+	if (failures > 0) {
+		printf("%d failed\n", failures);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}